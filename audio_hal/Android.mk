@@ -32,17 +32,29 @@ ifeq ($(strip $(BOARD_USES_ALSA_AUDIO)),true)
   endif
 
   ifeq ($(strip $(TARGET_BOARD_PLATFORM)), omap3)
-    LOCAL_SRC_FILES:= alsa_omap3.cpp
+    LOCAL_SRC_FILES:= alsa_omap3.cpp \
+                       alsa_omap_core.cpp \
+                       alsa_omap_drain.cpp \
+                       alsa_omap_dsp.cpp \
+                       alsa_omap_stats.cpp \
+                       alsa_omap_trace.cpp
     ifeq ($(strip $(BOARD_USES_TI_OMAP_MODEM_AUDIO)),true)
-      LOCAL_SRC_FILES += alsa_omap3_modem.cpp
+      LOCAL_SRC_FILES += alsa_omap3_modem.cpp \
+                         audio_modem_null.cpp
     endif
   endif
   ifeq ($(strip $(TARGET_BOARD_PLATFORM)), omap4)
     LOCAL_SRC_FILES:= alsa_omap4.cpp \
-                       Omap4ALSAManager.cpp
-    LOCAL_SHARED_LIBRARIES += libmedia
+                       Omap4ALSAManager.cpp \
+                       alsa_omap_core.cpp \
+                       alsa_omap_drain.cpp \
+                       alsa_omap_dsp.cpp \
+                       alsa_omap_pcm.cpp \
+                       alsa_omap_stats.cpp \
+                       alsa_omap_trace.cpp
     ifeq ($(strip $(BOARD_USES_TI_OMAP_MODEM_AUDIO)),true)
-      LOCAL_SRC_FILES += alsa_omap4_modem.cpp
+      LOCAL_SRC_FILES += alsa_omap4_modem.cpp \
+                         audio_modem_null.cpp
     endif
   endif
 
@@ -52,6 +64,7 @@ ifeq ($(strip $(BOARD_USES_ALSA_AUDIO)),true)
     liblog \
     libcutils \
     libutils \
+    libmedia \
     libdl
 
   ifeq ($(strip $(BOARD_USES_TI_OMAP_MODEM_AUDIO)),true)
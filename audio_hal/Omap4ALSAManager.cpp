@@ -26,6 +26,16 @@ namespace android {
 const char *Omap4ALSAManager::MAIN_MIC = "omap.audio.mic.main";
 const char *Omap4ALSAManager::SUB_MIC = "omap.audio.mic.sub";
 const char *Omap4ALSAManager::POWER_MODE = "omap.audio.power";
+// Playback latency target of the "Adaptive" power mode
+// value: 5000us..500000us
+const char *Omap4ALSAManager::LATENCY_TARGET = "omap.audio.latency.target";
+const char *Omap4ALSAManager::CAPTURE_MODE = "omap.audio.capture";
+// Echo reference on the right channel of stereo VoIP captures
+// value: 0 (off) or 1 (on)
+const char *Omap4ALSAManager::ECHO_REFERENCE = "omap.audio.echo.reference";
+// Software crossover and limiter instead of the DL2 high-pass on the speaker
+// value: 0 (off) or 1 (on)
+const char *Omap4ALSAManager::SPEAKER_PROTECTION = "omap.audio.speaker.protection";
 
 // Voice record during voice call voice uplink gain
 // value: -120dB..29dB step 1dB (-120 is mute)
@@ -70,6 +80,14 @@ const char  *Omap4ALSAManager::MicNameList[]= {
 const char  *Omap4ALSAManager::PowerModeList[] = {
     "FIFO",  // low latency 4 periods per buffer
     "PingPong",  // low power ping pong using MM_LP_DEVICE
+    "Auto",  // FIFO, media moves to MM_LP_DEVICE while the screen is off
+    "Adaptive",  // FIFO sized from the latency target and observed underruns
+    "eof"
+};
+
+const char  *Omap4ALSAManager::CaptureModeList[] = {
+    "Normal",  // 250ms buffer, RW access
+    "LowLatency",  // short mmap periods, reader woken every period
     "eof"
 };
 
@@ -207,6 +225,18 @@ status_t Omap4ALSAManager::validateValueForKey(const String8& key, String8& valu
             else
                 return NO_ERROR;
     }
+    else if (key == (String8)CAPTURE_MODE) {
+        ALOGV("validate capture mode");
+        while (noMatch && strcmp(CaptureModeList[i], "eof")) {
+                noMatch = strcmp(CaptureModeList[i], value.string());
+                if (noMatch) i++;
+                else break;
+            }
+            if(noMatch)
+                return BAD_VALUE;
+            else
+                return NO_ERROR;
+    }
     else if ((key == (String8)DL2L_EQ_PROFILE) ||
              (key == (String8)DL2R_EQ_PROFILE) ||
              (key == (String8)DL1_EQ_PROFILE) ||
@@ -247,6 +277,22 @@ status_t Omap4ALSAManager::validateValueForKey(const String8& key, String8& valu
         else
             return BAD_VALUE;
     }
+    else if (key == (String8)LATENCY_TARGET) {
+        ALOGV("validate latency target");
+        gain = atoi((const char *)value);
+        if ((5000 <= gain) && (gain <= 500000))
+            return NO_ERROR;
+        else
+            return BAD_VALUE;
+    }
+    else if ((key == (String8)ECHO_REFERENCE) ||
+             (key == (String8)SPEAKER_PROTECTION)) {
+        ALOGV("validate on/off switch");
+        if ((value == (String8)"0") || (value == (String8)"1"))
+            return NO_ERROR;
+        else
+            return BAD_VALUE;
+    }
     else {
         // @TODO: add constraints as required
         return NO_ERROR;
@@ -45,6 +45,10 @@ class Omap4ALSAManager
         static const char* MAIN_MIC;
         static const char* SUB_MIC;
         static const char* POWER_MODE;
+        static const char* LATENCY_TARGET;
+        static const char* CAPTURE_MODE;
+        static const char* ECHO_REFERENCE;
+        static const char* SPEAKER_PROTECTION;
         static const char* DL2L_EQ_PROFILE;
         static const char* DL2R_EQ_PROFILE;
         static const char* DL1_EQ_PROFILE;
@@ -67,6 +71,7 @@ class Omap4ALSAManager
 
         static const char  *MicNameList[];
         static const char  *PowerModeList[];
+        static const char  *CaptureModeList[];
         static const char  *EqualizerProfileList[];
 
 };
@@ -18,10 +18,17 @@
 #define LOG_TAG "Omap3ALSA"
 #include <utils/Log.h>
 #include <utils/Mutex.h>
+#include <cutils/properties.h>
 
 #include "AudioHardwareALSA.h"
 #include <media/AudioRecord.h>
 
+#include "alsa_omap_core.h"
+#include "alsa_omap_dsp.h"
+#include "alsa_omap_drain.h"
+#include "alsa_omap_stats.h"
+#include "alsa_omap_trace.h"
+
 #ifdef AUDIO_MODEM_TI
 #include "audio_modem_interface.h"
 #include "alsa_omap3_modem.h"
@@ -30,6 +37,12 @@
 #define BLUETOOTH_SCO_DEVICE "hw:0,2"
 #define FM_TRANSMIT_DEVICE "hw:0,3"
 #define EXT_USB_DEVICE "hw:1,0"
+#define EXT_USB_PLUG_DEVICE "plughw:1,0"
+#define EXT_USB_CARD 1
+
+// s_set() key and system property picking the profile of the default
+// output, one of the _outputProfiles names. Applies at the next open.
+#define OUTPUT_PROFILE_KEY "omap.audio.output.profile"
 
 #ifndef ALSA_DEFAULT_SAMPLE_RATE
 #define ALSA_DEFAULT_SAMPLE_RATE 44100 // in Hz
@@ -48,6 +61,7 @@ static status_t s_close(alsa_handle_t *);
 static status_t s_standby(alsa_handle_t *);
 static status_t s_route(alsa_handle_t *, uint32_t, int);
 static status_t s_voicevolume(float);
+static status_t s_set(const String8&);
 static status_t s_resetDefaults(alsa_handle_t *handle);
 
 #ifdef AUDIO_MODEM_TI
@@ -90,6 +104,7 @@ static int s_device_open(const hw_module_t* module, const char* name,
     dev->standby = s_standby;
     dev->route = s_route;
     dev->voicevolume = s_voicevolume;
+    dev->set = s_set;
     dev->resetDefaults = s_resetDefaults;
 
     *device = &dev->common;
@@ -220,8 +235,92 @@ static alsa_handle_t _defaults[] = {
     },
 };
 
+// Profiles of the OMAP3_OUT_DEFAULT output. libaudio only ever opens that
+// one playback handle, so the profiles share it and OUTPUT_PROFILE_KEY
+// picks the one in use: UI and media can't be active at the same time,
+// switching replaces the profile of all default output at its next open.
+typedef struct {
+    const char *name;
+    unsigned int latency;           // Desired Delay in usec
+    snd_pcm_uframes_t bufferSize;   // Desired Number of samples
+    alsa_pcm_policy_t policy;
+} output_profile_t;
+
+static const output_profile_t _outputProfiles[] = {
+    // long buffer that only starts once full: fewest wakeups for music
+    { "media", 90702, 2048, { ALSA_START_BUFFER, ALSA_STOP_XRUN, 0 } },
+    // short buffer that starts once 5ms are queued, so clicks and key
+    // tones don't wait for the buffer to fill; nothing runs before the
+    // first write, so an open followed by a pause can't underrun
+    { "ui", 23220, 1024, { ALSA_START_TIME, ALSA_STOP_XRUN, 5000 } },
+};
+
+static const output_profile_t *_outputProfile = &_outputProfiles[0];
+
+static int setOutputProfile(const char *name)
+{
+    for (size_t i = 0; i < ARRAY_SIZE(_outputProfiles); i++) {
+        if (strcmp(_outputProfiles[i].name, name) == 0) {
+            _outputProfile = &_outputProfiles[i];
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
 // ----------------------------------------------------------------------------
 
+snd_pcm_stream_t direction(alsa_handle_t *handle)
+{
+    return (handle->devices & AudioSystem::DEVICE_OUT_ALL) ? SND_PCM_STREAM_PLAYBACK
+            : SND_PCM_STREAM_CAPTURE;
+}
+
+const char *streamName(alsa_handle_t *handle)
+{
+    return snd_pcm_stream_name(direction(handle));
+}
+
+// Native capabilities of the USB card on EXT_USB_CARD, probed the first
+// time a stream goes to it after it appeared. The card name tells a re-plug
+// of another card apart, which is probed again.
+static char usbCardName[80];
+static alsa_pcm_caps_t usbCaps[SND_PCM_STREAM_LAST + 1];
+
+// EXT_USB_DEVICE when the card runs the handle's config natively, its plug
+// device when a conversion is needed. Without a card the hw: name is
+// returned as well, its open fails and s_open() falls back to the codec.
+static const char *usbDeviceName(alsa_handle_t *handle)
+{
+    snd_pcm_stream_t stream = direction(handle);
+    char *name = NULL;
+
+    if (snd_card_get_name(EXT_USB_CARD, &name) < 0) {
+        usbCardName[0] = '\0';
+        return EXT_USB_DEVICE;
+    }
+
+    if (strcmp(name, usbCardName) != 0) {
+        ALOGI("USB audio card %s", name);
+        strlcpy(usbCardName, name, sizeof(usbCardName));
+        for (size_t i = 0; i < ARRAY_SIZE(usbCaps); i++)
+            usbCaps[i].probed = false;
+    }
+    free(name);
+
+    if (!usbCaps[stream].probed &&
+        (android::alsaPcmProbeCaps(EXT_USB_DEVICE, stream, &usbCaps[stream]) < 0))
+        return EXT_USB_DEVICE;
+
+    if (android::alsaPcmCapsMatch(&usbCaps[stream], handle->mmap, handle->format,
+                                  handle->channels, handle->sampleRate))
+        return EXT_USB_DEVICE;
+
+    ALOGI("USB %s %u Hz %u channels not native, converting", streamName(handle),
+          handle->sampleRate, handle->channels);
+    return EXT_USB_PLUG_DEVICE;
+}
+
 const char *deviceName(alsa_handle_t *handle, uint32_t device, int mode)
 {
     if (device & OMAP3_OUT_SCO || device & OMAP3_IN_SCO)
@@ -233,21 +332,47 @@ const char *deviceName(alsa_handle_t *handle, uint32_t device, int mode)
     /* Let's see if this is external device match attempt first */
     if (device & AudioSystem::DEVICE_OUT_WIRED_HEADSET ||
 	device & AudioSystem::DEVICE_IN_WIRED_HEADSET)
-	return EXT_USB_DEVICE;
+	return usbDeviceName(handle);
 
     return "default";
 }
 
-snd_pcm_stream_t direction(alsa_handle_t *handle)
+// how the PCM of each profile was last opened, so that a drained tail is
+// only taken back by an open that would pick the same device and EQ
+typedef struct {
+    const char *device;
+    uint32_t stages;                // alsaDspOpen() stages, 0 for a plain PCM
+} open_state_t;
+
+static open_state_t _opened[ARRAY_SIZE(_defaults)];
+
+static const open_state_t *openState(alsa_handle_t *handle)
 {
-ALOGE("direction requext. devices %d, mask %d,  result %d\n", handle->devices, AudioSystem::DEVICE_OUT_ALL, handle->devices & AudioSystem::DEVICE_OUT_ALL);
-    return (handle->devices & AudioSystem::DEVICE_OUT_ALL) ? SND_PCM_STREAM_PLAYBACK
-            : SND_PCM_STREAM_CAPTURE;
+    static const open_state_t unknown = { NULL, 0 };
+    int i = android::alsaProfileIndex(_defaults, handle->devices);
+
+    return (i < 0) ? &unknown : &_opened[i];
 }
 
-const char *streamName(alsa_handle_t *handle)
+// what s_open() would open now: the USB card if one is plugged, otherwise
+// the device it falls back to
+static open_state_t openTarget(alsa_handle_t *handle, uint32_t devices, int mode)
 {
-    return snd_pcm_stream_name(direction(handle));
+    open_state_t target;
+    char *name = NULL;
+
+    if (snd_card_get_name(EXT_USB_CARD, &name) == 0) {
+        free(name);
+        devices |= mode ? AudioSystem::DEVICE_IN_WIRED_HEADSET :
+                          AudioSystem::DEVICE_OUT_WIRED_HEADSET;
+    } else {
+        devices &= ~(AudioSystem::DEVICE_IN_WIRED_HEADSET |
+                     AudioSystem::DEVICE_OUT_WIRED_HEADSET);
+    }
+    target.device = deviceName(handle, devices, mode);
+    target.stages = ((direction(handle) == SND_PCM_STREAM_PLAYBACK) &&
+                     !android::alsaEqFlat()) ? ALSA_DSP_EQ : 0;
+    return target;
 }
 
 status_t setHardwareParams(alsa_handle_t *handle)
@@ -260,16 +385,6 @@ status_t setHardwareParams(alsa_handle_t *handle)
     unsigned int latency = handle->latency;
     int periodSizeScaleFactor = 0;
 
-    // snd_pcm_format_description() and snd_pcm_format_name() do not perform
-    // proper bounds checking.
-    bool validFormat = (static_cast<int> (handle->format)
-            > SND_PCM_FORMAT_UNKNOWN) && (static_cast<int> (handle->format)
-            <= SND_PCM_FORMAT_LAST);
-    const char *formatDesc = validFormat ? snd_pcm_format_description(
-            handle->format) : "Invalid Format";
-    const char *formatName = validFormat ? snd_pcm_format_name(handle->format)
-            : "UNKNOWN";
-
 #if 0
     if (direction(handle)==SND_PCM_STREAM_PLAYBACK) {
         /* For playback, configure ALSA use our "standard" period size */
@@ -294,50 +409,14 @@ status_t setHardwareParams(alsa_handle_t *handle)
         goto done;
     }
 
-    // Set the interleaved read and write format.
-    err = snd_pcm_hw_params_set_access(handle->handle, hardwareParams,
-            SND_PCM_ACCESS_RW_INTERLEAVED);
-    if (err < 0) {
-        ALOGE("Unable to configure PCM read/write format: %s",
-                snd_strerror(err));
-        goto done;
-    }
-
-    err = snd_pcm_hw_params_set_format(handle->handle, hardwareParams,
-            handle->format);
-    if (err < 0) {
-        ALOGE("Unable to configure PCM format %s (%s): %s",
-                formatName, formatDesc, snd_strerror(err));
+    err = alsaPcmSetFormat(handle->handle, hardwareParams, handle->mmap,
+            handle->format, handle->channels);
+    if (err < 0)
         goto done;
-    }
-
-    ALOGI("Set %s PCM format to %s (%s)", streamName(handle), formatName, formatDesc);
 
-    err = snd_pcm_hw_params_set_channels(handle->handle, hardwareParams,
-            handle->channels);
-    if (err < 0) {
-        ALOGE("Unable to set channel count to %i: %s",
-                handle->channels, snd_strerror(err));
-        goto done;
-    }
-
-    ALOGI("Using %i %s for %s.", handle->channels,
-            handle->channels == 1 ? "channel" : "channels", streamName(handle));
-
-    err = snd_pcm_hw_params_set_rate_near(handle->handle, hardwareParams,
-            &requestedRate, 0);
-
-    if (err < 0)
-        ALOGE("Unable to set %s sample rate to %u: %s",
-                streamName(handle), handle->sampleRate, snd_strerror(err));
-    else if (requestedRate != handle->sampleRate)
-        // Some devices have a fixed sample rate, and can not be changed.
-        // This may cause resampling problems; i.e. PCM playback will be too
-        // slow or fast.
-        ALOGW("Requested rate (%u HZ) does not match actual rate (%u HZ)",
-                handle->sampleRate, requestedRate);
-    else
-        ALOGI("Set %s sample rate to %u HZ", streamName(handle), requestedRate);
+    err = alsaPcmSetRate(handle->handle, hardwareParams,
+            alsaProfileIndex(_defaults, handle->devices),
+            &handle->sampleRate, &requestedRate);
 
     // Setup buffers for latency
     err = snd_pcm_hw_params_set_buffer_time_near(handle->handle,
@@ -397,6 +476,7 @@ status_t setHardwareParams(alsa_handle_t *handle)
     // Commit the hardware parameters back to the device.
     err = snd_pcm_hw_params(handle->handle, hardwareParams);
     if (err < 0) ALOGE("Unable to set hardware parameters: %s", snd_strerror(err));
+    else alsaPcmRateCommit(alsaProfileIndex(_defaults, handle->devices));
 
     done:
     snd_pcm_hw_params_free(hardwareParams);
@@ -406,75 +486,25 @@ status_t setHardwareParams(alsa_handle_t *handle)
 
 status_t setSoftwareParams(alsa_handle_t *handle)
 {
-    snd_pcm_sw_params_t * softwareParams;
-    int err;
-
-    snd_pcm_uframes_t bufferSize = 0;
-    snd_pcm_uframes_t periodSize = 0;
-    snd_pcm_uframes_t startThreshold, stopThreshold;
-
-    if (snd_pcm_sw_params_malloc(&softwareParams) < 0) {
-        LOG_ALWAYS_FATAL("Failed to allocate ALSA software parameters!");
-        return NO_INIT;
-    }
-
-    // Get the current software parameters
-    err = snd_pcm_sw_params_current(handle->handle, softwareParams);
-    if (err < 0) {
-        ALOGE("Unable to get software parameters: %s", snd_strerror(err));
-        goto done;
-    }
-
-    // Configure ALSA to start the transfer when the buffer is almost full.
-    snd_pcm_get_params(handle->handle, &bufferSize, &periodSize);
+    alsa_pcm_policy_t policy;
 
-    if (handle->devices & AudioSystem::DEVICE_OUT_ALL) {
+    if (handle->devices == OMAP3_OUT_DEFAULT) {
+        policy = _outputProfile->policy;
+    } else if (direction(handle) == SND_PCM_STREAM_PLAYBACK) {
         // For playback, configure ALSA to start the transfer when the
         // buffer is full.
-        startThreshold = bufferSize - 1;
-        stopThreshold = bufferSize;
+        policy.start = ALSA_START_BUFFER;
+        policy.stop = ALSA_STOP_XRUN;
+        policy.startTime = 0;
     } else {
         // For recording, configure ALSA to start the transfer on the
         // first frame.
-        startThreshold = 1;
-        stopThreshold = bufferSize;
+        policy.start = ALSA_START_FIRST_FRAME;
+        policy.stop = ALSA_STOP_XRUN;
+        policy.startTime = 0;
     }
 
-    err = snd_pcm_sw_params_set_start_threshold(handle->handle, softwareParams,
-            startThreshold);
-    if (err < 0) {
-        ALOGE("Unable to set start threshold to %lu frames: %s",
-                startThreshold, snd_strerror(err));
-        goto done;
-    }
-
-    err = snd_pcm_sw_params_set_stop_threshold(handle->handle, softwareParams,
-            stopThreshold);
-    if (err < 0) {
-        ALOGE("Unable to set stop threshold to %lu frames: %s",
-                stopThreshold, snd_strerror(err));
-        goto done;
-    }
-
-    // Allow the transfer to start when at least periodSize samples can be
-    // processed.
-    err = snd_pcm_sw_params_set_avail_min(handle->handle, softwareParams,
-            periodSize);
-    if (err < 0) {
-        ALOGE("Unable to configure available minimum to %lu: %s",
-                periodSize, snd_strerror(err));
-        goto done;
-    }
-
-    // Commit the software parameters back to the device.
-    err = snd_pcm_sw_params(handle->handle, softwareParams);
-    if (err < 0) ALOGE("Unable to configure software parameters: %s",
-            snd_strerror(err));
-
-    done:
-    snd_pcm_sw_params_free(softwareParams);
-
-    return err;
+    return alsaPcmSetSoftwareParams(handle->handle, &policy);
 }
 
 void setScoControls(uint32_t devices, int mode)
@@ -557,6 +587,9 @@ static status_t s_init(alsa_device_t *module, ALSAHandleList &list)
 
     list.clear();
 
+    // the handles below start from the default rates again
+    alsaPcmRateReset();
+
     for (size_t i = 0; i < ARRAY_SIZE(_defaults); i++) {
 
         snd_pcm_uframes_t bufferSize = _defaults[i].bufferSize;
@@ -575,18 +608,43 @@ static status_t s_init(alsa_device_t *module, ALSAHandleList &list)
     audioModem = new AudioModemAlsa(&control);
 #endif
 
+    char eq[PROPERTY_VALUE_MAX];
+    if (property_get(ALSA_EQ_KEY, eq, "") && (android::alsaEqSet(eq) < 0))
+        ALOGE("Invalid %s property: %s", ALSA_EQ_KEY, eq);
+
+    char profile[PROPERTY_VALUE_MAX];
+    if (property_get(OUTPUT_PROFILE_KEY, profile, "") &&
+        (setOutputProfile(profile) < 0))
+        ALOGE("Invalid %s property: %s", OUTPUT_PROFILE_KEY, profile);
+
     return NO_ERROR;
 }
 
 static status_t s_open(alsa_handle_t *handle, uint32_t devices, int mode, uint32_t channels)
 {
+    android::AlsaOpTimer timer(android::ALSA_OP_OPEN);
+    android::alsaTrace(android::ALSA_TRACE_OPEN, devices, handle->sampleRate);
     // Close off previously opened device.
     // It would be nice to determine if the underlying device actually
     // changes, but we might be recovering from an error or manipulating
     // mixer settings (see asound.conf).
     //
+    // A stream back on the route it left, typically out of standby, takes
+    // over its PCM if the tail is still playing.
+    bool handoff = (devices == handle->curDev) && (mode == handle->curMode) &&
+                   (channels == handle->curChannels);
     s_close(handle);
 
+    open_state_t target = openTarget(handle, devices, mode);
+    handle->handle = android::alsaDrainReclaim(handle, direction(handle), handoff,
+                                               target.device, target.stages);
+    if (handle->handle) {
+        ALOGV("%s continues on its running PCM", streamName(handle));
+        android::alsaStatsOpen(handle, handle->handle, devices);
+        setAlsaControls(handle, devices, mode, channels);
+        return NO_ERROR;
+    }
+
     // We start by requiring USB headset, we'll retry if it does not work
     // hackity-hack...
     devices |= mode ? AudioSystem::DEVICE_IN_WIRED_HEADSET :\
@@ -601,8 +659,17 @@ open_again:
 
     // The PCM stream is opened in blocking mode, per ALSA defaults.  The
     // AudioFlinger seems to assume blocking mode too, so asynchronous mode
-    // should not be used.
-    int err = snd_pcm_open(&handle->handle, devName, direction(handle), 0);
+    // should not be used. Playback goes through the software EQ unless it
+    // is flat; a gain change while the stream runs flat applies at the
+    // next open.
+    int err;
+    uint32_t stages = 0;
+    if ((direction(handle) == SND_PCM_STREAM_PLAYBACK) && !android::alsaEqFlat()) {
+        stages = ALSA_DSP_EQ;
+        err = android::alsaDspOpen(&handle->handle, devName, direction(handle), 0,
+                                   stages);
+    } else
+        err = snd_pcm_open(&handle->handle, devName, direction(handle), 0);
 
     if (err < 0) {
 	if (devices & (AudioSystem::DEVICE_OUT_WIRED_HEADSET |
@@ -614,11 +681,25 @@ open_again:
         ALOGE("Failed to Initialize any ALSA %s %s device: %s", stream, devName, snd_strerror(err));
         return NO_INIT;
     }
+    int profile = android::alsaProfileIndex(_defaults, handle->devices);
+    if (profile >= 0) {
+        _opened[profile].device = devName;
+        _opened[profile].stages = stages;
+    }
+
+    // the hw params overwrite these with what they got, so start every
+    // open of the default output from the profile in use
+    if (handle->devices == OMAP3_OUT_DEFAULT) {
+        handle->latency = _outputProfile->latency;
+        handle->bufferSize = _outputProfile->bufferSize;
+    }
 
     err = setHardwareParams(handle);
 
     if (err == NO_ERROR) err = setSoftwareParams(handle);
 
+    if (err == NO_ERROR) android::alsaStatsOpen(handle, handle->handle, devices);
+
     setAlsaControls(handle, devices, mode, channels);
 
     ALOGI("Initialized ALSA %s device %s", stream, devName);
@@ -627,6 +708,8 @@ open_again:
 
 static status_t s_close(alsa_handle_t *handle)
 {
+    android::AlsaOpTimer timer(android::ALSA_OP_CLOSE);
+    android::alsaTrace(android::ALSA_TRACE_CLOSE, handle->curDev, 0);
     status_t err = NO_ERROR;
     snd_pcm_t *h = handle->handle;
     handle->handle = 0;
@@ -634,8 +717,11 @@ static status_t s_close(alsa_handle_t *handle)
     handle->curMode = 0;
     handle->curChannels = 0;
     if (h) {
-        snd_pcm_drain(h);
-        err = snd_pcm_close(h);
+        android::alsaStatsClose(handle, NULL);
+        // the tail plays out on the drainer thread, a USB card pulled
+        // mid-stream is closed right away
+        const open_state_t *opened = openState(handle);
+        err = android::alsaDrainClose(handle, h, opened->device, opened->stages);
         if (err)
             ALOGE("Failed closing ALSA stream: %s", snd_strerror(err));
     }
@@ -651,13 +737,18 @@ static status_t s_close(alsa_handle_t *handle)
 */
 static status_t s_standby(alsa_handle_t *handle)
 {
+    android::AlsaOpTimer timer(android::ALSA_OP_STANDBY);
+    android::alsaTrace(android::ALSA_TRACE_STANDBY, handle->curDev, 0);
     status_t err = NO_ERROR;
     snd_pcm_t *h = handle->handle;
     handle->handle = 0;
     ALOGV("In omap3 standby\n");
     if (h) {
-        snd_pcm_drain(h);
-        err = snd_pcm_close(h);
+        android::alsaStatsClose(handle, NULL);
+        // the tail plays out on the drainer thread, a USB card pulled
+        // mid-stream is closed right away
+        const open_state_t *opened = openState(handle);
+        err = android::alsaDrainClose(handle, h, opened->device, opened->stages);
         if (err)
             ALOGE("Failed closing ALSA stream: %s", snd_strerror(err));
         ALOGV("called drain&close\n");
@@ -668,10 +759,15 @@ static status_t s_standby(alsa_handle_t *handle)
 
 static status_t s_route(alsa_handle_t *handle, uint32_t devices, int mode)
 {
+    android::AlsaOpTimer timer(android::ALSA_OP_ROUTE);
+    android::alsaTrace(android::ALSA_TRACE_ROUTE, devices, mode);
     status_t status = NO_ERROR;
 
     ALOGD("route called for devices %08x in mode %d...", devices, mode);
 
+    if (handle->handle)
+        android::alsaStatsSample(handle);
+
     if (handle->handle && handle->curDev == devices && handle->curMode == mode)
         ; // Nothing to do
     else if (handle->handle && (handle->devices & devices))
@@ -705,6 +801,39 @@ static status_t s_voicevolume(float volume)
     return status;
 }
 
+static status_t s_set(const String8& keyValuePairs)
+{
+    android::AudioParameter p = android::AudioParameter(keyValuePairs);
+    String8 value;
+
+    ALOGV("set:: %s", keyValuePairs.string());
+
+    if (p.get((String8)ALSA_STATS_KEY, value) == NO_ERROR) {
+        android::alsaStatsDump();
+        p.remove((String8)ALSA_STATS_KEY);
+    }
+
+    if (p.get((String8)ALSA_TRACE_KEY, value) == NO_ERROR) {
+        android::alsaTraceDump();
+        p.remove((String8)ALSA_TRACE_KEY);
+    }
+
+    // an invalid value stays in p and fails the call
+    if ((p.get((String8)ALSA_EQ_KEY, value) == NO_ERROR) &&
+        (android::alsaEqSet(value.string()) == 0))
+        p.remove((String8)ALSA_EQ_KEY);
+
+    if ((p.get((String8)OUTPUT_PROFILE_KEY, value) == NO_ERROR) &&
+        (setOutputProfile(value.string()) == 0))
+        p.remove((String8)OUTPUT_PROFILE_KEY);
+
+    if (p.size()) {
+        return BAD_VALUE;
+    } else {
+        return NO_ERROR;
+    }
+}
+
 static status_t s_resetDefaults(alsa_handle_t *handle)
 {
     return setHardwareParams(handle);
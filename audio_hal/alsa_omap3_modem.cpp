@@ -16,7 +16,6 @@
  */
 
 #define LOG_TAG "Omap3ALSAModem"
-#define LOG_NDEBUG 0
 
 #include <utils/Log.h>
 #include <cutils/properties.h>
@@ -33,6 +32,7 @@
 
 #include "AudioHardwareALSA.h"
 #include "audio_modem_interface.h"
+#include "audio_modem_null.h"
 #include "alsa_omap3_modem.h"
 
 namespace android
@@ -73,17 +73,19 @@ AudioModemAlsa::AudioModemAlsa(ALSAControl *alsaControl)
         if (error != NO_ERROR) {
             ALOGE("Audio Modem Interface was not correctly initialized.");
             delete mModem;
-            exit(error);
+            mModem = new AudioModemNull();
         }
     }
     else {
         ALOGE("No Audio Modem Interface found.");
-        exit(-1);
+        mModem = new AudioModemNull();
     }
     mVoiceCallState = AUDIO_MODEM_VOICE_CALL_OFF;
 
-    // Initialize Min and Max volume
+    // Initialize Min and Max volume. A board without the mixer controls
+    // still comes up, voiceCallVolume() then reports the failure
     int i = 0;
+    mVolumeInitStatus = NO_ERROR;
     while(voiceCallVolumeProp[i].device) {
         voiceCallVolumeInfo *info = voiceCallVolumeProp[i].mInfo = new voiceCallVolumeInfo;
 
@@ -93,9 +95,10 @@ AudioModemAlsa::AudioModemAlsa(ALSAControl *alsaControl)
                  info->min, info->max);
 
         if (error != NO_ERROR) {
-            ALOGE("Audio Voice Call volume was not correctly initialized.");
-            delete mModem;
-            exit(error);
+            ALOGE("Audio Voice Call volume %s was not correctly initialized.",
+                  voiceCallVolumeProp[i].volumeName);
+            info->min = info->max = 0;
+            mVolumeInitStatus = error;
         }
         i++;
     }
@@ -118,19 +121,25 @@ AudioModemInterface* AudioModemAlsa::create()
                  libPath,
                  AUDIO_MODEM_LIB_DEFAULT_PATH);
 
+    if (!strcmp(libPath, AUDIO_MODEM_NULL_PATH))
+        return(new AudioModemNull());
+
     ALOGW_IF(!strcmp(libPath, AUDIO_MODEM_LIB_DEFAULT_PATH),
                     "Use generic Modem interface");
 
+    // Without its modem library the HAL still has to come up: fall back
+    // to the null modem rather than taking the media server down with it
     dlHandle = dlopen(libPath, RTLD_NOW);
     if (dlHandle == NULL) {
         ALOGE("Audio Modem %s dlopen failed: %s\n", libPath, dlerror());
-        exit(-1);
+        return(new AudioModemNull());
     }
 
     audioModem = (AudioModemInterface *(*)(void))dlsym(dlHandle, "createAudioModemInterface");
     if (audioModem == NULL) {
         ALOGE("createAudioModemInterface function not defined or not exported in %s\n", libPath);
-        exit(-1);
+        dlclose(dlHandle);
+        return(new AudioModemNull());
     }
 
     return(audioModem());
@@ -1007,6 +1016,9 @@ status_t AudioModemAlsa::voiceCallVolume(ALSAControl *alsaControl, float volume)
     unsigned int setVolume;
     int i = 0;
 
+    if (mVolumeInitStatus != NO_ERROR)
+        return mVolumeInitStatus;
+
     while(voiceCallVolumeProp[i].device) {
         voiceCallVolumeInfo *info = voiceCallVolumeProp[i].mInfo;
 
@@ -300,6 +300,7 @@ public:
         status_t     voiceCallCodecBTPCMReset(void);
     #endif
     status_t voiceCallVolume(ALSAControl *alsaControl, float volume);
+    status_t mVolumeInitStatus;     // volume control range query result
 
     char        *mBoardName;
     ALSAControl *mAlsaControl;
@@ -21,9 +21,14 @@
 #include "AudioHardwareALSA.h"
 #include <media/AudioRecord.h>
 #include "alsa_omap4.h"
+#include "alsa_omap_core.h"
+#include "alsa_omap_dsp.h"
+#include "alsa_omap_drain.h"
+#include "alsa_omap_pcm.h"
+#include "alsa_omap_stats.h"
+#include "alsa_omap_trace.h"
 
-static bool fm_enable = false;
-static bool mActive = false;
+static bool screen_off = false;
 
 namespace android
 {
@@ -94,6 +99,13 @@ static int s_device_open(const hw_module_t* module, const char* name,
 
 static int s_device_close(hw_device_t* device)
 {
+#ifdef AUDIO_MODEM_TI
+    // a control thread stuck in the modem library still uses the object,
+    // which is then left behind rather than freed under it
+    if (audioModem && (audioModem->voiceCallControlsStop() == NO_ERROR))
+        delete audioModem;
+    audioModem = NULL;
+#endif
     free(device);
     return 0;
 }
@@ -187,7 +199,7 @@ static alsa_handle_t _defaults[] = {
         modPrivate  : (void *)&setAlsaControls,
     },
     {
-        /* not currently used */
+        /* deep buffer playback for long-form media on MM_LP_DEVICE */
         module      : 0,
         devices     : OMAP4_OUT_LP,
         curDev      : 0,
@@ -197,8 +209,8 @@ static alsa_handle_t _defaults[] = {
         format      : SND_PCM_FORMAT_S16_LE,
         channels    : 2,
         sampleRate  : DEFAULT_SAMPLE_RATE,
-        latency     : 140000,
-        bufferSize  : 6144,
+        latency     : MM_LP_LATENCY,
+        bufferSize  : MM_LP_BUFFER_SIZE,
         mmap        : 1,
         modPrivate  : (void *)&setAlsaControls,
     },
@@ -252,6 +264,110 @@ static alsa_handle_t _defaults[] = {
 
 // ----------------------------------------------------------------------------
 
+// FM Rx loopback through the ABE: the FM capture PCM (McPDM UL) feeds the
+// "DL1/DL2 Capture Playback" mixer inputs and a running playback PCM keeps
+// McPDM DL clocked. Once both are running a route change only needs to
+// move the FM gain between DL1 and DL2.
+typedef struct {
+    bool enabled;
+    alsa_handle_t *capture;         // OMAP4_IN_FM handle
+    alsa_handle_t *playback;        // output handle clocking McPDM DL
+    bool mixerValid;                // dl1Volume/dl2Volume match the hardware
+    unsigned int dl1Volume;         // "DL1 Capture Playback Volume"
+    unsigned int dl2Volume;         // "DL2 Capture Playback Volume"
+} fm_loopback_t;
+
+static fm_loopback_t fmLoopback;
+
+// Duplicated output: one stereo stream split by the route plugin onto the
+// four channels of a multi PCM whose slaves are the ABE multimedia port
+// (0,0) and HDMI (0,7). The slaves are defined inline so the local config
+// opened with snd_pcm_open_lconf() doesn't depend on the global one.
+static const char duplicateConfig[] =
+    "pcm." DUPLICATE_DEVICE " {\n"
+    "    type plug\n"
+    "    slave.pcm {\n"
+    "        type route\n"
+    "        slave.channels 4\n"
+    "        slave.pcm {\n"
+    "            type multi\n"
+    "            slaves.a.pcm { type plug slave.pcm { type hw card 0 device 0 } }\n"
+    "            slaves.a.channels 2\n"
+    "            slaves.b.pcm { type plug slave.pcm { type hw card 0 device 7 } }\n"
+    "            slaves.b.channels 2\n"
+    "            bindings.0 { slave a channel 0 }\n"
+    "            bindings.1 { slave a channel 1 }\n"
+    "            bindings.2 { slave b channel 0 }\n"
+    "            bindings.3 { slave b channel 1 }\n"
+    "        }\n"
+    "        ttable.0.0 1\n"
+    "        ttable.1.1 1\n"
+    "        ttable.0.2 1\n"
+    "        ttable.1.3 1\n"
+    "    }\n"
+    "}\n";
+
+static snd_config_t *duplicateConf = NULL;
+
+static int openDuplicate(snd_pcm_t **pcm, snd_pcm_stream_t stream)
+{
+    snd_input_t *in;
+    int err;
+
+    if (!duplicateConf) {
+        err = snd_config_top(&duplicateConf);
+        if (err < 0)
+            return err;
+        err = snd_input_buffer_open(&in, duplicateConfig, -1);
+        if (err == 0) {
+            err = snd_config_load(duplicateConf, in);
+            snd_input_close(in);
+        }
+        if (err < 0) {
+            ALOGE("Unable to load the duplicated output config: %s", snd_strerror(err));
+            snd_config_delete(duplicateConf);
+            duplicateConf = NULL;
+            return err;
+        }
+    }
+
+    return snd_pcm_open_lconf(pcm, DUPLICATE_DEVICE, stream, 0, duplicateConf);
+}
+
+// Native capabilities of the front ends reached through plughw. Probed at
+// s_init, or at the first open when the front end has no backend path yet
+// at init time.
+typedef struct {
+    const char *name;               // plughw device as returned by deviceName
+    snd_pcm_stream_t stream;
+    alsa_pcm_caps_t caps;
+} hw_caps_t;
+
+static hw_caps_t hwCaps[] = {
+    { MM_DEFAULT_DEVICE, SND_PCM_STREAM_PLAYBACK },
+    { MM_DEFAULT_DEVICE, SND_PCM_STREAM_CAPTURE },
+    { FM_CAPTURE_DEVICE, SND_PCM_STREAM_CAPTURE },
+    { HDMI_DEVICE,       SND_PCM_STREAM_PLAYBACK },
+};
+
+// adaptive period sizing state, one entry per _defaults profile
+typedef struct {
+    snd_pcm_uframes_t bufferSize;   // frames requested at the next open
+    unsigned int cleanRuns;         // consecutive sessions without underrun
+    unsigned int xruns;             // sessions that ended up underrunning
+} adaptive_state_t;
+
+static adaptive_state_t _adaptive[ARRAY_SIZE(_defaults)];
+
+// how the PCM of each profile was last opened, so that a drained tail is
+// only taken back by an open that would pick the same device and DSP
+typedef struct {
+    const char *device;
+    uint32_t stages;                // alsaDspOpen() stages, 0 for a plain PCM
+} open_state_t;
+
+static open_state_t _opened[ARRAY_SIZE(_defaults)];
+
 const char *deviceName(alsa_handle_t *handle, uint32_t device, int mode)
 {
     char pwr[PROPERTY_VALUE_MAX];
@@ -264,6 +380,9 @@ const char *deviceName(alsa_handle_t *handle, uint32_t device, int mode)
     if (device & OMAP4_OUT_FM)
         return FM_TRANSMIT_DEVICE;
 
+    if ((device & OMAP4_OUT_HDMI) && (device & OMAP4_OUT_DEFAULT))
+        return DUPLICATE_DEVICE;
+
     if (device & OMAP4_OUT_HDMI)
         return HDMI_DEVICE;
 
@@ -275,7 +394,7 @@ const char *deviceName(alsa_handle_t *handle, uint32_t device, int mode)
 
     // Hostless loopback is not supported in kernel for FM with  0,6
     // so for FM Rx, the default playback device retured is MM_DEFAULT_DEVICE i.e. 0,0
-    if (fm_enable)
+    if (fmLoopback.enabled)
         return MM_DEFAULT_DEVICE;
 
     // now that low-power is flexible in buffer size and sample rate
@@ -284,6 +403,15 @@ const char *deviceName(alsa_handle_t *handle, uint32_t device, int mode)
        (strcmp(pwr, "PingPong") == 0))
         return MM_LP_DEVICE;
 
+    // "Auto" is opt-in: while the screen is off, all of the default output
+    // moves to the deep buffer path, not only music. The HAL can't tell a
+    // media stream from notifications, alarms or UI sounds, which then get
+    // the ~340ms ping-pong latency too. The switch only happens when the
+    // stream is (re)opened, i.e. at the next standby/open boundary.
+    if ((strcmp(pwr, "Auto") == 0) && screen_off &&
+        (mode == AudioSystem::MODE_NORMAL))
+        return MM_LP_DEVICE;
+
     return MM_DEFAULT_DEVICE;
 }
 
@@ -298,6 +426,116 @@ const char *streamName(alsa_handle_t *handle)
     return snd_pcm_stream_name(direction(handle));
 }
 
+// capture through the ABE ports in "LowLatency" mode, FM Rx is buffer-less
+static bool lowLatencyCapture(alsa_handle_t *handle)
+{
+    String8 mode;
+
+    if ((direction(handle) != SND_PCM_STREAM_CAPTURE) ||
+        (handle->devices & OMAP4_IN_FM))
+        return false;
+
+    return (propMgr.get((String8)Omap4ALSAManager::CAPTURE_MODE, mode) == NO_ERROR) &&
+           (mode == (String8)"LowLatency");
+}
+
+static const open_state_t *openState(alsa_handle_t *handle)
+{
+    static const open_state_t unknown = { NULL, 0 };
+    int i = alsaProfileIndex(_defaults, handle->devices);
+
+    return (i < 0) ? &unknown : &_opened[i];
+}
+
+static adaptive_state_t *adaptiveState(alsa_handle_t *handle)
+{
+    char pwr[PROPERTY_VALUE_MAX];
+    int i = alsaProfileIndex(_defaults, handle->devices);
+
+    property_get("omap.audio.power", pwr, "FIFO");
+    if (strcmp(pwr, "Adaptive") || (direction(handle) != SND_PCM_STREAM_PLAYBACK))
+        return NULL;
+
+    return (i < 0) ? NULL : &_adaptive[i];
+}
+
+static snd_pcm_uframes_t adaptiveBufferSize(adaptive_state_t *adaptive, unsigned int rate)
+{
+    int target;
+    snd_pcm_uframes_t minSize, maxSize;
+
+    if (propMgr.get((String8)Omap4ALSAManager::LATENCY_TARGET, target) != NO_ERROR)
+        target = atoi(ADAPTIVE_LATENCY_TARGET);
+
+    minSize = (snd_pcm_uframes_t)((uint64_t)target * rate / 1000000);
+    maxSize = minSize * ADAPTIVE_MAX_FACTOR;
+    if (adaptive->bufferSize < minSize)
+        adaptive->bufferSize = minSize;
+    if (adaptive->bufferSize > maxSize)
+        adaptive->bufferSize = maxSize;
+
+    return adaptive->bufferSize;
+}
+
+// called at the end of a playback session with what the stats saw of it
+static void adaptiveUpdate(alsa_handle_t *handle, snd_pcm_t *h,
+                           const alsa_stats_session_t& session)
+{
+    adaptive_state_t *adaptive = adaptiveState(handle);
+    snd_pcm_uframes_t bufferSize = session.bufferSize;
+    snd_pcm_uframes_t availMax = session.availMax;
+    bool xrun = session.xruns > 0;
+
+    if (!adaptive || !bufferSize || (strcmp(snd_pcm_name(h), MM_LP_DEVICE) == 0))
+        return;
+
+    if (xrun) {
+        adaptive->xruns++;
+        adaptive->cleanRuns = 0;
+        adaptive->bufferSize = bufferSize * 2;
+    } else if (availMax < bufferSize / 2) {
+        if (++adaptive->cleanRuns >= ADAPTIVE_SHRINK_RUNS) {
+            adaptive->cleanRuns = 0;
+            adaptive->bufferSize = bufferSize - bufferSize / 4;
+        }
+    } else {
+        adaptive->cleanRuns = 0;
+    }
+
+    ALOGI("Adaptive %s: xrun %d (%u total), avail max %lu/%lu, next buffer %lu frames",
+          streamName(handle), xrun, adaptive->xruns, availMax, bufferSize,
+          adaptive->bufferSize);
+}
+
+static status_t probeHwCaps(hw_caps_t *caps)
+{
+    return (alsaPcmProbeCaps(caps->name + strlen("plug"), caps->stream,
+                             &caps->caps) == 0) ? NO_ERROR : NO_INIT;
+}
+
+// hw: name to open instead of a plughw device when the handle's config is
+// native to the front end, NULL when the conversions are really needed
+static const char *rawDeviceName(alsa_handle_t *handle, const char *devName)
+{
+    hw_caps_t *caps = NULL;
+
+    for (size_t i = 0; i < ARRAY_SIZE(hwCaps); i++) {
+        if ((strcmp(hwCaps[i].name, devName) == 0) &&
+            (hwCaps[i].stream == direction(handle))) {
+            caps = &hwCaps[i];
+            break;
+        }
+    }
+    if (!caps || (!caps->caps.probed && (probeHwCaps(caps) != NO_ERROR)))
+        return NULL;
+
+    if (!alsaPcmCapsMatch(&caps->caps, handle->mmap, handle->format,
+                          handle->channels, handle->sampleRate))
+        return NULL;
+
+    return devName + strlen("plug");
+}
+
 status_t setHardwareParams(alsa_handle_t *handle)
 {
     snd_pcm_hw_params_t *hardwareParams;
@@ -307,24 +545,14 @@ status_t setHardwareParams(alsa_handle_t *handle)
     unsigned int periodTime, bufferTime;
     unsigned int requestedRate = handle->sampleRate;
     int numPeriods = 0;
+    adaptive_state_t *adaptive;
     char pwr[PROPERTY_VALUE_MAX];
     int status = 0;
 
-    // snd_pcm_format_description() and snd_pcm_format_name() do not perform
-    // proper bounds checking.
-    bool validFormat = (static_cast<int> (handle->format)
-            > SND_PCM_FORMAT_UNKNOWN) && (static_cast<int> (handle->format)
-            <= SND_PCM_FORMAT_LAST);
-    const char *formatDesc = validFormat ? snd_pcm_format_description(
-            handle->format) : "Invalid Format";
-    const char *formatName = validFormat ? snd_pcm_format_name(handle->format)
-            : "UNKNOWN";
-
-    // device name will only return LP device hw06 if the property is set
-    // or if the system is explicitly opening and routing to OMAP4_OUT_LP
-    const char* device = deviceName(handle,
-                                    handle->curDev,
-                                    AudioSystem::MODE_NORMAL);
+    // the PCM was opened on the LP device hw06 if the power property is set,
+    // if the screen-off policy picked it or if the system is explicitly
+    // opening and routing to OMAP4_OUT_LP
+    const char* device = snd_pcm_name(handle->handle);
 
     if (snd_pcm_hw_params_malloc(&hardwareParams) < 0) {
         LOG_ALWAYS_FATAL("Failed to allocate ALSA hardware parameters!");
@@ -337,66 +565,21 @@ status_t setHardwareParams(alsa_handle_t *handle)
         goto done;
     }
 
-    // Set the interleaved read and write format.
-    if (handle->mmap) {
-        snd_pcm_access_mask_t *mask =
-            (snd_pcm_access_mask_t *)alloca(snd_pcm_access_mask_sizeof());
-        snd_pcm_access_mask_none(mask);
-        snd_pcm_access_mask_set(mask, SND_PCM_ACCESS_MMAP_INTERLEAVED);
-        err = snd_pcm_hw_params_set_access_mask(
-                        handle->handle,
-                        hardwareParams,
-                        mask);
-    } else  {
-        err = snd_pcm_hw_params_set_access(
-                        handle->handle,
-                        hardwareParams,
-                        SND_PCM_ACCESS_RW_INTERLEAVED);
-    }
-    if (err < 0) {
-        ALOGE("Unable to configure PCM read/write format: %s",
-                snd_strerror(err));
-        goto done;
-    }
-
-    err = snd_pcm_hw_params_set_format(handle->handle, hardwareParams,
-            handle->format);
-    if (err < 0) {
-        ALOGE("Unable to configure PCM format %s (%s): %s",
-                formatName, formatDesc, snd_strerror(err));
-        goto done;
-    }
-
-    ALOGV("Set %s PCM format to %s (%s)", streamName(handle), formatName, formatDesc);
-
-    err = snd_pcm_hw_params_set_channels(handle->handle, hardwareParams,
-            handle->channels);
-    if (err < 0) {
-        ALOGE("Unable to set channel count to %i: %s",
-                handle->channels, snd_strerror(err));
+    err = alsaPcmSetFormat(handle->handle, hardwareParams, handle->mmap,
+            handle->format, handle->channels);
+    if (err < 0)
         goto done;
-    }
-
-    ALOGV("Using %i %s for %s.", handle->channels,
-            handle->channels == 1 ? "channel" : "channels", streamName(handle));
 
-    err = snd_pcm_hw_params_set_rate_near(handle->handle, hardwareParams,
-            &requestedRate, 0);
-    if (err < 0)
-        ALOGE("Unable to set %s sample rate to %u: %s",
-                streamName(handle), handle->sampleRate, snd_strerror(err));
-    else if (requestedRate != handle->sampleRate)
-        // Some devices have a fixed sample rate, and can not be changed.
-        // This may cause resampling problems; i.e. PCM playback will be too
-        // slow or fast.
-        ALOGW("Requested rate (%u HZ) does not match actual rate (%u HZ)",
-                handle->sampleRate, requestedRate);
-    else
-        ALOGV("Set %s sample rate to %u HZ", streamName(handle), requestedRate);
+    err = alsaPcmSetRate(handle->handle, hardwareParams,
+            alsaProfileIndex(_defaults, handle->devices),
+            &handle->sampleRate, &requestedRate);
 
     if (strcmp(device, MM_LP_DEVICE) == 0) {
-        numPeriods = 2;
+        numPeriods = MM_LP_NUM_PERIODS;
         ALOGI("Using ping-pong!");
+    } else if (lowLatencyCapture(handle)) {
+        numPeriods = LL_CAPTURE_NUM_PERIODS;
+        ALOGI("Using low latency capture");
     } else {
         numPeriods = 4;
         ALOGI("Using FIFO");
@@ -409,6 +592,23 @@ status_t setHardwareParams(alsa_handle_t *handle)
             break;
         }
     }
+    // a default stream moved to the LP device gets the deep buffer too
+    if ((strcmp(device, MM_LP_DEVICE) == 0) && (reqBuffSize < MM_LP_BUFFER_SIZE))
+        reqBuffSize = MM_LP_BUFFER_SIZE;
+
+    // in adaptive mode the FIFO buffer follows the latency target and the
+    // underruns seen on the previous sessions of this profile
+    if (strcmp(device, MM_LP_DEVICE) && (adaptive = adaptiveState(handle))) {
+        reqBuffSize = adaptiveBufferSize(adaptive, requestedRate);
+        if ((uint64_t)reqBuffSize * 1000000 / numPeriods / requestedRate <
+            ADAPTIVE_MIN_PERIOD_TIME)
+            numPeriods = 2;
+        ALOGI("Adaptive %s: buffer %lu frames, %d periods",
+              streamName(handle), reqBuffSize, numPeriods);
+    }
+    if (lowLatencyCapture(handle))
+        reqBuffSize = (snd_pcm_uframes_t)((uint64_t)requestedRate *
+                      LL_CAPTURE_PERIOD_TIME * numPeriods / 1000000);
     bufferSize = reqBuffSize;
 
     // try the requested buffer size
@@ -464,10 +664,13 @@ status_t setHardwareParams(alsa_handle_t *handle)
 
     ALOGI("Buffer size: %d", (int)(handle->bufferSize));
     ALOGI("Latency: %d", (int)(handle->latency));
+    ALOGI("Period: %d frames x %d, %u wakeups/s", (int)periodSize,
+          (int)(bufferSize / periodSize), periodTime ? 1000000 / periodTime : 0);
 
     // Commit the hardware parameters back to the device.
     err = snd_pcm_hw_params(handle->handle, hardwareParams);
     if (err < 0) ALOGE("Unable to set hardware parameters: %s", snd_strerror(err));
+    else alsaPcmRateCommit(alsaProfileIndex(_defaults, handle->devices));
 
     done:
     snd_pcm_hw_params_free(hardwareParams);
@@ -477,81 +680,420 @@ status_t setHardwareParams(alsa_handle_t *handle)
 
 status_t setSoftwareParams(alsa_handle_t *handle)
 {
-    snd_pcm_sw_params_t * softwareParams;
-    int err;
+    alsa_pcm_policy_t policy;
+
+    if (direction(handle) == SND_PCM_STREAM_PLAYBACK) {
+        // For playback, configure ALSA to start the transfer at period full
+        policy.start = ALSA_START_PERIOD;
+        policy.stop = ALSA_STOP_XRUN;
+    } else {
+        // For recording, configure ALSA to start the transfer on the
+        // first frame. FM Rx via ABE keeps running without a reader.
+        policy.start = ALSA_START_FIRST_FRAME;
+        policy.stop = (handle->devices & OMAP4_IN_FM) ?
+                ALSA_STOP_NEVER : ALSA_STOP_XRUN;
+    }
+    policy.startTime = 0;
+
+    return alsaPcmSetSoftwareParams(handle->handle, &policy);
+}
 
-    snd_pcm_uframes_t bufferSize = 0;
-    snd_pcm_uframes_t periodSize = 0;
-    snd_pcm_uframes_t startThreshold, stopThreshold;
 
-    if (snd_pcm_sw_params_malloc(&softwareParams) < 0) {
-        LOG_ALWAYS_FATAL("Failed to allocate ALSA software parameters!");
-        return NO_INIT;
+// moves the FM gain to the DL path of the given output devices, only
+// writing the controls that actually change
+static void fmLoopbackMixer(ALSAControl &control, uint32_t devices)
+{
+    unsigned int dl1 = 0, dl2 = 0;
+
+    if (fmLoopback.enabled) {
+        if (devices & (AudioSystem::DEVICE_OUT_EARPIECE |
+                       AudioSystem::DEVICE_OUT_WIRED_HEADSET |
+                       AudioSystem::DEVICE_OUT_LOW_POWER))
+            dl1 = FM_LOOPBACK_VOLUME;
+        else if (devices & AudioSystem::DEVICE_OUT_SPEAKER)
+            dl2 = FM_LOOPBACK_VOLUME;
     }
 
-    // Get the current software parameters
-    err = snd_pcm_sw_params_current(handle->handle, softwareParams);
-    if (err < 0) {
-        ALOGE("Unable to get software parameters: %s", snd_strerror(err));
-        goto done;
+    if (!fmLoopback.mixerValid || (fmLoopback.dl1Volume != dl1)) {
+        ALOGI("FM DL1 Capture-Playback Vol %u", dl1);
+        control.set("DL1 Capture Playback Volume", dl1, -1);
+        fmLoopback.dl1Volume = dl1;
+    }
+    if (!fmLoopback.mixerValid || (fmLoopback.dl2Volume != dl2)) {
+        ALOGI("FM DL2 Capture-Playback Vol %u", dl2);
+        control.set("DL2 Capture Playback Volume", dl2, -1);
+        fmLoopback.dl2Volume = dl2;
     }
+    fmLoopback.mixerValid = true;
+}
+
+// McPDM DL has to be clocked for the FM samples to reach the outputs. The
+// kernel won't start an empty playback ring, so one period of silence is
+// rendered in place first.
+static void fmLoopbackTrigger(alsa_handle_t *handle)
+{
+    snd_pcm_uframes_t bufferSize, periodSize;
+    snd_pcm_state_t state = snd_pcm_state(handle->handle);
 
-    // Configure ALSA to start the transfer when the buffer is almost full.
-    snd_pcm_get_params(handle->handle, &bufferSize, &periodSize);
+    fmLoopback.playback = handle;
+    if (state == SND_PCM_STATE_RUNNING)
+        return;
+    if (state != SND_PCM_STATE_PREPARED)
+        snd_pcm_prepare(handle->handle);
 
-    if (handle->devices & AudioSystem::DEVICE_OUT_ALL ||
-        handle->devices & AudioSystem::DEVICE_OUT_LOW_POWER) {
-        // For playback, configure ALSA to start the transfer at period full
-        startThreshold = periodSize;
-        stopThreshold = bufferSize;
-    } else {
-        // For recording, configure ALSA to start the transfer on the
-        // first frame.
-        startThreshold = 1;
-        if (handle->devices & OMAP4_IN_FM) {
-            ALOGV("Stop Threshold for FM Rx is -1");
-            stopThreshold = -1; // For FM Rx via ABE
-        } else
-            stopThreshold = bufferSize;
+    if (handle->mmap &&
+        (snd_pcm_get_params(handle->handle, &bufferSize, &periodSize) == 0))
+        alsaMmapSilence(handle->handle, handle->format, handle->channels, periodSize);
+
+    ALOGI("Triggering McPDM DL");
+    snd_pcm_start(handle->handle);
+}
+
+static void fmLoopbackStop()
+{
+    ALSAControl control("hw:00");
+
+    ALOGI("FM loopback stopped");
+    fmLoopback.enabled = false;
+    fmLoopback.capture = NULL;
+    fmLoopback.playback = NULL;
+    fmLoopbackMixer(control, 0);
+}
+
+// Output routing table. Each entry lists the controls required when one
+// of its devices is routed (on) and when none is (off). The resolver walks
+// the table in order, a later entry overriding an earlier one for the same
+// control, so every control is written once with its final value.
+typedef struct {
+    const char *name;
+    const char *str;                // enumerated value, NULL if numeric
+    unsigned int value;
+    int index;
+} route_control_t;
+
+typedef struct {
+    uint32_t devices;
+    const route_control_t *on;
+    const route_control_t *off;
+} route_entry_t;
+
+#define ROUTE_ALL_OUTPUTS   0x0000FFFF
+#define ROUTE_MAX_CONTROLS  32
+
+static const route_control_t routeSpeakerOn[] = {
+    /* OMAP4 ABE */
+    { "DL2 Mixer Multimedia", NULL, 1, -1 },        // MM_DL    -> DL2 Mixer
+    { "DL2 Media Playback Volume", NULL, 118, -1 },
+    /* TWL6040 */
+    { "HF Left Playback", "HF DAC", 0, 0 },         // HFDAC L -> HF Mux
+    { "HF Right Playback", "HF DAC", 0, 0 },        // HFDAC R -> HF Mux
+    { "Handsfree Playback Volume", NULL, 23, -1 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeSpeakerOff[] = {
+    /* OMAP4 ABE */
+    { "DL2 Mixer Multimedia", NULL, 0, 0 },
+    { "DL2 Media Playback Volume", NULL, 0, -1 },
+    /* TWL6040 */
+    { "HF Left Playback", "Off", 0, 0 },
+    { "HF Right Playback", "Off", 0, 0 },
+    { "Handsfree Playback Volume", NULL, 0, -1 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeHeadsetOn[] = {
+    /* TWL6040 */
+    { "HS Left Playback", "HS DAC", 0, 0 },         // HSDAC L -> HS Mux
+    { "HS Right Playback", "HS DAC", 0, 0 },        // HSDAC R -> HS Mux
+    { "Headset Playback Volume", NULL, 15, -1 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeHeadsetOff[] = {
+    /* TWL6040 */
+    { "HS Left Playback", "Off", 0, 0 },
+    { "HS Right Playback", "Off", 0, 0 },
+    { "Headset Playback Volume", NULL, 0, -1 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeEarpieceOn[] = {
+    /* TWL6040 */
+    { "EP Playback", "On", 0, 0 },                  // HSDACL -> Earpiece
+    { "Earphone Playback Volume", NULL, 15, -1 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeEarpieceOff[] = {
+    /* TWL6040 */
+    { "Earphone Playback Volume", NULL, 0, -1 },
+    { "EP Playback", "Off", 0, 0 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeDL1On[] = {
+    /* OMAP4 ABE */
+    { "DL1 Mixer Multimedia", NULL, 1, -1 },        // MM_DL    -> DL1 Mixer
+    { "Sidetone Mixer Playback", NULL, 1, -1 },     // DL1 Mixer-> Sidetone Mixer
+    { "SDT DL Volume", NULL, 118, -1 },
+    { "DL1 Media Playback Volume", NULL, 118, -1 },
+    { "DL1 PDM Switch", NULL, 1, -1 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeDL1Off[] = {
+    /* OMAP4 ABE */
+    { "DL1 Mixer Multimedia", NULL, 0, 0 },
+    { "Sidetone Mixer Playback", NULL, 0, 0 },
+    { "SDT DL Volume", NULL, 0, 0 },
+    { "DL1 PDM Switch", NULL, 0, 0 },
+    { "DL1 Media Playback Volume", NULL, 0, -1 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeFmTxOn[] = {
+    /* OMAP4 ABE */
+    { "DL1 Mixer Multimedia", NULL, 1, -1 },        // MM_DL    -> DL1 Mixer
+    { "Sidetone Mixer Playback", NULL, 1, -1 },     // DL1 Mixer-> Sidetone Mixer
+    { "SDT DL Volume", NULL, 118, -1 },
+    { "DL1 Media Playback Volume", NULL, 118, -1 },
+    { "DL1 MM_EXT Switch", NULL, 1, -1 },
+    { "DL1 PDM Switch", NULL, 0, 0 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeFmTxOff[] = {
+    /* Disable MM_EXT Switch */
+    { "DL1 MM_EXT Switch", NULL, 0, 0 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeScoOn[] = {
+    /* OMAP4 ABE */
+    /* Bluetooth: DL1 Mixer */
+    { "DL1 Mixer Multimedia", NULL, 1, -1 },        // MM_DL    -> DL1 Mixer
+    { "Sidetone Mixer Playback", NULL, 1, -1 },     // DL1 Mixer-> Sidetone Mixer
+    { "SDT DL Volume", NULL, 118, -1 },
+    { "DL1 BT_VX Switch", NULL, 1, -1 },            // Sidetone Mixer -> BT-VX-DL
+    { "DL1 Media Playback Volume", NULL, 118, -1 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeScoOff[] = {
+    { "DL1 BT_VX Switch", NULL, 0, 0 },
+    { NULL, NULL, 0, 0 }
+};
+
+// Setting DL2 EQ's to 800Hz cut-off frequency, as setting
+// to flat response saturates the audio quality in the
+// handsfree speakers
+static const route_control_t routeDL2EqOn[] = {
+    { "DL2 Left Equalizer", "High-pass 0dB", 0, 0 },
+    { "DL2 Right Equalizer", "High-pass 0dB", 0, 0 },
+    { NULL, NULL, 0, 0 }
+};
+
+// the software speaker protection does the high-pass instead
+static const route_control_t routeDL2EqFlat[] = {
+    { "DL2 Left Equalizer", "Flat response", 0, 0 },
+    { "DL2 Right Equalizer", "Flat response", 0, 0 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routeDL1EqOn[] = {
+    { "DL1 Equalizer", "Flat response", 0, 0 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_control_t routePowerMode[] = {
+    { "TWL6040 Power Mode", "Low-Power", 0, 0 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const route_entry_t routeTable[] = {
+    { AudioSystem::DEVICE_OUT_SPEAKER,
+      routeSpeakerOn, routeSpeakerOff },
+    { AudioSystem::DEVICE_OUT_WIRED_HEADSET |
+      AudioSystem::DEVICE_OUT_LOW_POWER,
+      routeHeadsetOn, routeHeadsetOff },
+    { AudioSystem::DEVICE_OUT_EARPIECE,
+      routeEarpieceOn, routeEarpieceOff },
+    { AudioSystem::DEVICE_OUT_EARPIECE |
+      AudioSystem::DEVICE_OUT_WIRED_HEADSET |
+      AudioSystem::DEVICE_OUT_LOW_POWER,
+      routeDL1On, routeDL1Off },
+    { AudioSystem::DEVICE_OUT_FM_TRANSMIT,
+      routeFmTxOn, routeFmTxOff },
+    { OMAP4_OUT_SCO,
+      routeScoOn, routeScoOff },
+    { AudioSystem::DEVICE_OUT_SPEAKER |
+      AudioSystem::DEVICE_OUT_AUX_DIGITAL,
+      routeDL2EqOn, NULL },
+    { AudioSystem::DEVICE_OUT_WIRED_HEADSET |
+      AudioSystem::DEVICE_OUT_EARPIECE,
+      routeDL1EqOn, NULL },
+    { ROUTE_ALL_OUTPUTS,
+      routePowerMode, NULL },
+};
+
+typedef struct {
+    size_t count;
+    route_control_t controls[ROUTE_MAX_CONTROLS];
+} route_state_t;
+
+static void routeMerge(route_state_t *state, const route_control_t *ctl)
+{
+    size_t i;
+
+    for (i = 0; i < state->count; i++) {
+        if (strcmp(state->controls[i].name, ctl->name) == 0)
+            break;
+    }
+    if (i == state->count) {
+        if (state->count == ROUTE_MAX_CONTROLS) {
+            ALOGE("route table: too many controls, dropping %s", ctl->name);
+            return;
+        }
+        state->count++;
     }
+    state->controls[i] = *ctl;
+}
 
-    err = snd_pcm_sw_params_set_start_threshold(handle->handle, softwareParams,
-            startThreshold);
-    if (err < 0) {
-        ALOGE("Unable to set start threshold to %lu frames: %s",
-                startThreshold, snd_strerror(err));
-        goto done;
+// mono mixer setting from its system property, if valid
+static void routeMergeMonoMixer(route_state_t *state, const char *key,
+                                const char *init, const char *name)
+{
+    String8 value;
+
+    if ((propMgr.setFromProperty((String8)key, (String8)init) == NO_ERROR) &&
+        (propMgr.get((String8)key, value) == NO_ERROR)) {
+        route_control_t ctl = { name, NULL, (unsigned int)atoi(value.string()), -1 };
+        ALOGD("%s value %s", name, value.string());
+        routeMerge(state, &ctl);
     }
+}
 
-    err = snd_pcm_sw_params_set_stop_threshold(handle->handle, softwareParams,
-            stopThreshold);
-    if (err < 0) {
-        ALOGE("Unable to set stop threshold to %lu frames: %s",
-                stopThreshold, snd_strerror(err));
-        goto done;
+// The speaker gets its high-pass and a peak limiter in software when every
+// signal on DL2 comes from a PCM of this module: not during a modem call or
+// FM Rx loopback, and not when HDMI is fed from the same stream.
+static bool speakerProtection(uint32_t devices, int mode)
+{
+    int enable = 0;
+
+    propMgr.get((String8)Omap4ALSAManager::SPEAKER_PROTECTION, enable);
+    return enable && (devices & AudioSystem::DEVICE_OUT_SPEAKER) &&
+           !(devices & OMAP4_OUT_HDMI) &&
+           (mode != AudioSystem::MODE_IN_CALL) && !fmLoopback.enabled;
+}
+
+static void setOutputRoute(ALSAControl &control, uint32_t devices, int mode)
+{
+    route_state_t state;
+    const route_control_t *ctl;
+
+    state.count = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(routeTable); i++) {
+        ctl = (devices & routeTable[i].devices) ? routeTable[i].on : routeTable[i].off;
+        for (; ctl && ctl->name; ctl++)
+            routeMerge(&state, ctl);
+    }
+    if (speakerProtection(devices, mode)) {
+        for (ctl = routeDL2EqFlat; ctl->name; ctl++)
+            routeMerge(&state, ctl);
     }
 
-    // Allow the transfer to start when at least periodSize samples can be
-    // processed.
-    err = snd_pcm_sw_params_set_avail_min(handle->handle, softwareParams,
-            periodSize);
-    if (err < 0) {
-        ALOGE("Unable to configure available minimum to %lu: %s",
-                periodSize, snd_strerror(err));
-        goto done;
+    if (devices & AudioSystem::DEVICE_OUT_SPEAKER)
+        routeMergeMonoMixer(&state, Omap4ALSAManager::DL2_SPEAK_MONO_MIXER,
+                            "0", "DL2 Mono Mixer");
+    if (devices & AudioSystem::DEVICE_OUT_EARPIECE)
+        routeMergeMonoMixer(&state, Omap4ALSAManager::DL1_EAR_MONO_MIXER,
+                            "1", "DL1 Mono Mixer");
+    else if (devices & (AudioSystem::DEVICE_OUT_WIRED_HEADSET |
+                        AudioSystem::DEVICE_OUT_LOW_POWER))
+        routeMergeMonoMixer(&state, Omap4ALSAManager::DL1_HEAD_MONO_MIXER,
+                            "0", "DL1 Mono Mixer");
+
+    for (size_t i = 0; i < state.count; i++) {
+        ctl = &state.controls[i];
+        if (ctl->str)
+            control.set(ctl->name, ctl->str);
+        else
+            control.set(ctl->name, ctl->value, ctl->index);
     }
+    ALOGV("%s: devices %08x, %d controls written", __FUNCTION__, devices, (int)state.count);
+}
 
-    // Commit the software parameters back to the device.
-    err = snd_pcm_sw_params(handle->handle, softwareParams);
-    if (err < 0) ALOGE("Unable to configure software parameters: %s",
-            snd_strerror(err));
+// writes a control list outside of a routing change
+static void setRouteControls(const route_control_t *ctl)
+{
+    ALSAControl control("hw:00");
 
-    done:
-    snd_pcm_sw_params_free(softwareParams);
+    for (; ctl->name; ctl++) {
+        if (ctl->str)
+            control.set(ctl->name, ctl->str);
+        else
+            control.set(ctl->name, ctl->value, ctl->index);
+    }
+}
 
-    return err;
+bool outputRouteControl(const char *name)
+{
+    const route_control_t *ctl;
+
+    if (!strcmp(name, "DL1 Mono Mixer") || !strcmp(name, "DL2 Mono Mixer"))
+        return true;
+
+    for (size_t i = 0; i < ARRAY_SIZE(routeTable); i++) {
+        for (ctl = routeTable[i].on; ctl && ctl->name; ctl++) {
+            if (!strcmp(ctl->name, name))
+                return true;
+        }
+        for (ctl = routeTable[i].off; ctl && ctl->name; ctl++) {
+            if (!strcmp(ctl->name, name))
+                return true;
+        }
+    }
+    for (ctl = routeDL2EqFlat; ctl->name; ctl++) {
+        if (!strcmp(ctl->name, name))
+            return true;
+    }
+    return false;
 }
 
+// VoIP echo reference: a stereo capture in communication mode gets the mic
+// on the left channel and the ABE VXREC mix of media playback and tones on
+// the right one. Both come out of the same UL frames, so the reference is
+// sample aligned with the mic and shares its capture timestamps.
+static bool echoReference = false;  // VXREC currently carries the reference
+
+static void setEchoReference(ALSAControl &control, alsa_handle_t *handle,
+                             uint32_t devices, int mode)
+{
+    int enable = 0;
+    bool active;
+
+    propMgr.get((String8)Omap4ALSAManager::ECHO_REFERENCE, enable);
+    active = enable && (mode == AudioSystem::MODE_IN_COMMUNICATION) &&
+             (devices & (AudioSystem::DEVICE_IN_BUILTIN_MIC |
+                         AudioSystem::DEVICE_IN_WIRED_HEADSET)) &&
+             (handle->channels == 2);
+
+    if (active) {
+        ALOGI("OMAP4 ABE set for VoIP echo reference");
+        control.set("Capture Mixer Voice Capture", 0, 0);
+        control.set("Capture Mixer Voice Playback", 0, 0);
+        control.set("Capture Mixer Media Playback", 1);
+        control.set("Capture Mixer Tones", 1);
+        control.set("VXREC Media Volume", ECHO_REF_VOLUME);
+        control.set("VXREC Tones Volume", ECHO_REF_VOLUME);
+        control.set("MUX_UL01", "VX Left");         // replaces the sub mic
+    } else if (echoReference) {
+        control.set("Capture Mixer Media Playback", 0, 0);
+        control.set("Capture Mixer Tones", 0, 0);
+    }
+    echoReference = active;
+}
 
 void setAlsaControls(alsa_handle_t *handle, uint32_t devices, int mode, uint32_t channels)
 {
@@ -561,143 +1103,8 @@ void setAlsaControls(alsa_handle_t *handle, uint32_t devices, int mode, uint32_t
     /* check whether the devices is input or not */
     /* for output devices */
     if (devices & 0x0000FFFF){
-        if (devices & AudioSystem::DEVICE_OUT_SPEAKER) {
-            /* OMAP4 ABE */
-            control.set("DL2 Mixer Multimedia", 1);		// MM_DL    -> DL2 Mixer
-            control.set("DL2 Media Playback Volume", 118);
-            /* TWL6040 */
-            control.set("HF Left Playback", "HF DAC");		// HFDAC L -> HF Mux
-            control.set("HF Right Playback", "HF DAC");		// HFDAC R -> HF Mux
-            control.set("Handsfree Playback Volume", 23);
-            if (fm_enable) {
-                ALOGE("FM Enabled, DL2 Capture-Playback Vol ON");
-                control.set("DL2 Capture Playback Volume", 115);
-                control.set("DL1 Capture Playback Volume", 0, -1);
-            }
-            else {
-                ALOGI("FM Disabled, DL2 Capture-Playback Vol OFF");
-                control.set("DL2 Capture Playback Volume", 0, -1);
-            }
-            if (propMgr.setFromProperty((String8)Omap4ALSAManager::DL2_SPEAK_MONO_MIXER, (String8)"0") == NO_ERROR) {
-                String8 value;
-                if (propMgr.get((String8)Omap4ALSAManager::DL2_SPEAK_MONO_MIXER, value) == NO_ERROR) {
-                    ALOGD("DL2 Mono Mixer value %s",value.string());
-                    control.set("DL2 Mono Mixer", atoi(value.string()));
-                }
-            }
-        } else {
-            /* OMAP4 ABE */
-            control.set("DL2 Mixer Multimedia", 0, 0);
-            control.set("DL2 Media Playback Volume", 0, -1);
-            control.set("DL2 Capture Playback Volume", 0, -1);
-            /* TWL6040 */
-            control.set("HF Left Playback", "Off");
-            control.set("HF Right Playback", "Off");
-            control.set("Handsfree Playback Volume", 0, -1);
-        }
-
-        if ((devices & AudioSystem::DEVICE_OUT_WIRED_HEADSET) ||
-            (devices & AudioSystem::DEVICE_OUT_LOW_POWER)) {
-            /* TWL6040 */
-            control.set("HS Left Playback", "HS DAC");		// HSDAC L -> HS Mux
-            control.set("HS Right Playback", "HS DAC");		// HSDAC R -> HS Mux
-            control.set("Headset Playback Volume", 15);
-            if (propMgr.setFromProperty((String8)Omap4ALSAManager::DL1_HEAD_MONO_MIXER, (String8)"0") == NO_ERROR) {
-                String8 value;
-                if (propMgr.get((String8)Omap4ALSAManager::DL1_HEAD_MONO_MIXER, value) == NO_ERROR) {
-                    ALOGD("DL1 Mono Mixer value %s",value.string());
-                    control.set("DL1 Mono Mixer", atoi(value.string()));
-                }
-            }
-        } else {
-            /* TWL6040 */
-            control.set("HS Left Playback", "Off");
-            control.set("HS Right Playback", "Off");
-            control.set("Headset Playback Volume", 0, -1);
-        }
-
-        if (devices & AudioSystem::DEVICE_OUT_EARPIECE) {
-            /* TWL6040 */
-            control.set("EP Playback", "On");		// HSDACL -> Earpiece
-            control.set("Earphone Playback Volume", 15);
-            if (propMgr.setFromProperty((String8)Omap4ALSAManager::DL1_EAR_MONO_MIXER, (String8)"1") == NO_ERROR) {
-                String8 value;
-                if (propMgr.get((String8)Omap4ALSAManager::DL1_EAR_MONO_MIXER, value) == NO_ERROR) {
-                    ALOGD("DL1 Mono Mixer value %s",value.string());
-                    control.set("DL1 Mono Mixer", atoi(value.string()));
-                }
-            }
-        } else {
-            /* TWL6040 */
-            control.set("Earphone Playback Volume", 0, -1);
-            control.set("EP Playback", "Off");
-        }
-        if ((devices & AudioSystem::DEVICE_OUT_EARPIECE) ||
-            (devices & AudioSystem::DEVICE_OUT_WIRED_HEADSET) ||
-            (devices & AudioSystem::DEVICE_OUT_LOW_POWER)) {
-            /* OMAP4 ABE */
-            control.set("DL1 Mixer Multimedia", 1);		// MM_DL    -> DL1 Mixer
-            control.set("Sidetone Mixer Playback", 1);		// DL1 Mixer-> Sidetone Mixer
-            control.set("SDT DL Volume", 118);
-            control.set("DL1 Media Playback Volume", 118);
-            control.set("DL1 PDM Switch", 1);
-            if (fm_enable) {
-                ALOGI("FM Enabled, DL1 Capture-Playback Vol ON");
-                control.set("DL1 Capture Playback Volume", 115);
-                control.set("DL2 Capture Playback Volume", 0, -1);
-            }
-            else {
-                ALOGI("FM Disabled, DL1 Capture-Playback Vol OFF");
-                control.set("DL1 Capture Playback Volume", 0, -1);
-            }
-        } else {
-            /* OMAP4 ABE */
-            control.set("DL1 Mixer Multimedia", 0, 0);
-            control.set("Sidetone Mixer Playback", 0, 0);
-            control.set("SDT DL Volume", 0, 0);
-            control.set("DL1 PDM Switch", 0, 0);
-            control.set("DL1 Media Playback Volume", 0, -1);
-            control.set("DL1 Capture Playback Volume", 0, -1);
-        }
-        if (devices & AudioSystem::DEVICE_OUT_FM_TRANSMIT) {
-            /* OMAP4 ABE */
-            control.set("DL1 Mixer Multimedia", 1);             // MM_DL    -> DL1 Mixer
-            control.set("Sidetone Mixer Playback", 1);          // DL1 Mixer-> Sidetone Mixer
-            control.set("SDT DL Volume", 118);
-            control.set("DL1 Media Playback Volume", 118);
-            control.set("DL1 MM_EXT Switch", 1);
-            control.set("DL1 PDM Switch", 0, 0);
-        } else {
-            /* Disable MM_EXT Switch */
-            control.set("DL1 MM_EXT Switch", 0, 0);
-        }
-        if ((devices & AudioSystem::DEVICE_OUT_BLUETOOTH_SCO) ||
-            (devices & AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_HEADSET) ||
-            (devices & AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_CARKIT)) {
-            /* OMAP4 ABE */
-            /* Bluetooth: DL1 Mixer */
-            control.set("DL1 Mixer Multimedia", 1);        // MM_DL    -> DL1 Mixer
-            control.set("Sidetone Mixer Playback", 1);     // DL1 Mixer-> Sidetone Mixer
-            control.set("SDT DL Volume", 118);
-            control.set("DL1 BT_VX Switch", 1);            // Sidetone Mixer -> BT-VX-DL
-            control.set("DL1 Media Playback Volume", 118);
-        } else {
-            control.set("DL1 BT_VX Switch", 0, 0);
-        }
-        if ((devices & AudioSystem::DEVICE_OUT_SPEAKER) ||
-            (devices & AudioSystem::DEVICE_OUT_AUX_DIGITAL)) {
-            // Setting DL2 EQ's to 800Hz cut-off frequency, as setting
-            // to flat response saturates the audio quality in the
-            // handsfree speakers
-            control.set("DL2 Left Equalizer", "High-pass 0dB");
-            control.set("DL2 Right Equalizer", "High-pass 0dB");
-        }
-        if ((devices & AudioSystem::DEVICE_OUT_WIRED_HEADSET) ||
-            (devices & AudioSystem::DEVICE_OUT_EARPIECE)) {
-            control.set("DL1 Equalizer", "Flat response");
-        }
-        control.set("TWL6040 Power Mode", "Low-Power");
-
+        setOutputRoute(control, devices, mode);
+        fmLoopbackMixer(control, devices);
     }
 
     /* for input devices */
@@ -756,6 +1163,12 @@ void setAlsaControls(alsa_handle_t *handle, uint32_t devices, int mode, uint32_t
             control.set("MUX_UL10", "None");
             control.set("MUX_UL11", "None");
         }
+
+        // voice memo owns the capture mixer, see configVoiceMemo()
+        if (devices & AudioSystem::DEVICE_IN_VOICE_CALL)
+            echoReference = false;
+        else
+            setEchoReference(control, handle, devices, mode);
     }
 
     handle->curDev = devices;
@@ -771,6 +1184,9 @@ static status_t s_init(alsa_device_t *module, ALSAHandleList &list)
     status_t status = NO_ERROR;
     list.clear();
 
+    // the handles below start from the default rates again
+    alsaPcmRateReset();
+
     for (size_t i = 0; i < ARRAY_SIZE(_defaults); i++) {
 
         snd_pcm_uframes_t bufferSize = _defaults[i].bufferSize;
@@ -784,8 +1200,15 @@ static status_t s_init(alsa_device_t *module, ALSAHandleList &list)
         list.push_back(_defaults[i]);
     }
 
+    // front ends without a backend path yet are probed again on first open
+    for (size_t i = 0; i < ARRAY_SIZE(hwCaps); i++)
+        probeHwCaps(&hwCaps[i]);
+
 #ifdef AUDIO_MODEM_TI
-    audioModem = new AudioModemAlsa();
+    if (!audioModem)
+        audioModem = new AudioModemAlsa();
+    ALOGE_IF(audioModem->initCheck() != NO_ERROR,
+             "Voice call control not available, calls won't be routed");
 #endif
 
     propMgr = Omap4ALSAManager();
@@ -794,6 +1217,14 @@ static status_t s_init(alsa_device_t *module, ALSAHandleList &list)
     status = propMgr.setFromProperty((String8)Omap4ALSAManager::MAIN_MIC);
     status = propMgr.setFromProperty((String8)Omap4ALSAManager::SUB_MIC);
     status = propMgr.setFromProperty((String8)Omap4ALSAManager::POWER_MODE);
+    status = propMgr.setFromProperty((String8)Omap4ALSAManager::LATENCY_TARGET,
+                                     (String8)ADAPTIVE_LATENCY_TARGET);
+    status = propMgr.setFromProperty((String8)Omap4ALSAManager::CAPTURE_MODE,
+                                     (String8)Omap4ALSAManager::CaptureModeList[0]);
+    status = propMgr.setFromProperty((String8)Omap4ALSAManager::ECHO_REFERENCE,
+                                     (String8)"1");
+    status = propMgr.setFromProperty((String8)Omap4ALSAManager::SPEAKER_PROTECTION,
+                                     (String8)"1");
 
     // initialize other tunable parameters with internal default values
     status = propMgr.set((String8)Omap4ALSAManager::DL2L_EQ_PROFILE,
@@ -830,17 +1261,49 @@ static status_t s_init(alsa_device_t *module, ALSAHandleList &list)
 
 static status_t s_open(alsa_handle_t *handle, uint32_t devices, int mode, uint32_t channels)
 {
+    AlsaOpTimer timer(ALSA_OP_OPEN);
+    alsaTrace(ALSA_TRACE_OPEN, devices, handle->sampleRate);
     // Close off previously opened device.
     // It would be nice to determine if the underlying device actually
     // changes, but we might be recovering from an error or manipulating
     // mixer settings (see asound.conf).
     //
+    // A stream back on the route it left, typically out of standby, takes
+    // over its PCM if the tail is still playing.
+    bool handoff = (devices == handle->curDev) && (mode == handle->curMode) &&
+                   (channels == handle->curChannels);
     s_close(handle);
 
-    ALOGD("open called for devices %08x in mode %d channels %08x...", devices, mode, channels);
-
     const char *stream = streamName(handle);
     const char *devName = deviceName(handle, devices, mode);
+    int profile = alsaProfileIndex(_defaults, handle->devices);
+    bool protection = (direction(handle) == SND_PCM_STREAM_PLAYBACK) &&
+                      speakerProtection(devices, mode);
+    open_state_t opened = { devName, protection ? ALSA_DSP_SPEAKER : 0 };
+
+    handle->handle = alsaDrainReclaim(handle, direction(handle), handoff,
+                                      opened.device, opened.stages);
+    if (handle->handle) {
+        ALOGV("%s continues on its running PCM", stream);
+#ifdef AUDIO_MODEM_TI
+        audioModem->voiceCallControlsMutexLock();
+#endif
+        setAlsaControls(handle, devices, mode, channels);
+#ifdef AUDIO_MODEM_TI
+        audioModem->voiceCallControlsMutexUnlock();
+        audioModem->voiceCallControls(devices, mode, true);
+#endif
+        alsaStatsOpen(handle, handle->handle, devices);
+        if (fmLoopback.enabled)
+            fmLoopbackTrigger(handle);
+        return NO_ERROR;
+    }
+
+    ALOGD("open called for devices %08x in mode %d channels %08x...", devices, mode, channels);
+
+    // low latency capture is read straight out of the DMA ring
+    if ((direction(handle) == SND_PCM_STREAM_CAPTURE) && (profile >= 0))
+        handle->mmap = lowLatencyCapture(handle) ? 1 : _defaults[profile].mmap;
 
 #ifdef AUDIO_MODEM_TI
     audioModem->voiceCallControlsMutexLock();
@@ -858,52 +1321,119 @@ static status_t s_open(alsa_handle_t *handle, uint32_t devices, int mode, uint32
     // The PCM stream is opened in blocking mode, per ALSA defaults.  The
     // AudioFlinger seems to assume blocking mode too, so asynchronous mode
     // should not be used.
-    int err = snd_pcm_open(&handle->handle, devName, direction(handle), 0);
+    int err;
+    bool configured = false;
+    bool dsp = false;
+    const char *rawName = rawDeviceName(handle, devName);
+    if (strcmp(devName, DUPLICATE_DEVICE) == 0)
+        err = openDuplicate(&handle->handle, direction(handle));
+    else if (protection &&
+             (alsaDspOpen(&handle->handle, rawName ? rawName : devName,
+                          direction(handle), 0, ALSA_DSP_SPEAKER) == 0)) {
+        dsp = true;
+        err = 0;
+        // same fallback as the raw path below, with the plugin on top of
+        // the plug device, and a plain PCM if even that doesn't open
+        if (rawName) {
+            if (setHardwareParams(handle) == NO_ERROR) {
+                devName = rawName;
+                configured = true;
+            } else {
+                ALOGW("%s refused the %s config, falling back to %s",
+                      rawName, stream, devName);
+                snd_pcm_close(handle->handle);
+                err = alsaDspOpen(&handle->handle, devName, direction(handle), 0,
+                                  ALSA_DSP_SPEAKER);
+                dsp = (err == 0);
+                if (!dsp)
+                    err = snd_pcm_open(&handle->handle, devName, direction(handle), 0);
+            }
+        }
+    } else if (rawName &&
+             (snd_pcm_open(&handle->handle, rawName, direction(handle), 0) == 0)) {
+        // the stream is native to the front end, skip the plug layer but
+        // keep it as a fallback if the hardware refuses the params anyway
+        if (setHardwareParams(handle) == NO_ERROR) {
+            devName = rawName;
+            configured = true;
+            err = 0;
+        } else {
+            ALOGW("%s refused the %s config, falling back to %s",
+                  rawName, stream, devName);
+            snd_pcm_close(handle->handle);
+            err = snd_pcm_open(&handle->handle, devName, direction(handle), 0);
+        }
+    } else
+        err = snd_pcm_open(&handle->handle, devName, direction(handle), 0);
+
+    if (protection && !dsp) {
+        // setAlsaControls() left DL2 flat for the software crossover
+        ALOGW("speaker protection unavailable, back to the DL2 high-pass");
+#ifdef AUDIO_MODEM_TI
+        audioModem->voiceCallControlsMutexLock();
+#endif
+        setRouteControls(routeDL2EqOn);
+#ifdef AUDIO_MODEM_TI
+        audioModem->voiceCallControlsMutexUnlock();
+#endif
+    }
 
     if (err < 0) {
         ALOGE("Failed to initialize ALSA %s device '%s': %s", stream, devName, strerror(err));
         return NO_INIT;
     }
+    opened.stages = dsp ? ALSA_DSP_SPEAKER : 0;
+    if (profile >= 0)
+        _opened[profile] = opened;
     ALOGV("snd_pcm_open(%p, %s, %s, 0)", handle->handle, devName,
          (direction(handle) == SND_PCM_STREAM_PLAYBACK) ? "SND_PCM_STREAM_PLAYBACK" : "SND_PCM_STREAM_CAPTURE");
 
-    mActive = true;
-
-    err = setHardwareParams(handle);
+    err = configured ? NO_ERROR : setHardwareParams(handle);
 
     if (err == NO_ERROR) err = setSoftwareParams(handle);
 
+    if (err == NO_ERROR) alsaStatsOpen(handle, handle->handle, devices);
+
     ALOGI("Initialized ALSA %s device '%s'", stream, devName);
 
-    if (fm_enable) {
-        ALOGI("Triggering McPDM DL");
-        snd_pcm_start(handle->handle);
-    }
+    if (err == NO_ERROR) {
+        if (fmLoopback.enabled && (direction(handle) == SND_PCM_STREAM_PLAYBACK))
+            fmLoopbackTrigger(handle);
 
-    // For FM Rx through ABE, McPDM UL needs to be triggered
-    if (devices &  OMAP4_IN_FM) {
-       ALOGI("Triggering McPDM UL");
-       fm_enable = true;
-       snd_pcm_start(handle->handle);
+        // For FM Rx through ABE, McPDM UL needs to be triggered
+        if (devices & OMAP4_IN_FM) {
+            ALOGI("Triggering McPDM UL");
+            fmLoopback.enabled = true;
+            fmLoopback.capture = handle;
+            snd_pcm_start(handle->handle);
+        }
     }
     return err;
 }
 
 static status_t s_close(alsa_handle_t *handle)
 {
+    AlsaOpTimer timer(ALSA_OP_CLOSE);
+    alsaTrace(ALSA_TRACE_CLOSE, handle->curDev, 0);
     status_t err = NO_ERROR;
     snd_pcm_t *h = handle->handle;
+    if (h && (handle == fmLoopback.capture))
+        fmLoopbackStop();
+    if (handle == fmLoopback.playback)
+        fmLoopback.playback = NULL;
     handle->handle = 0;
     handle->curDev = 0;
     handle->curMode = 0;
     handle->curChannels = 0;
     if (h) {
-        snd_pcm_drain(h);
-        err = snd_pcm_close(h);
+        alsa_stats_session_t session;
+        alsaStatsClose(handle, &session);
+        const open_state_t *opened = openState(handle);
+        adaptiveUpdate(handle, h, session);
+        err = alsaDrainClose(handle, h, opened->device, opened->stages);
         ALOGV("snd_pcm_close(%p): %s(%d) ", h,
              err != 0 ? strerror(err) : "no error",
              err != 0 ? err : 0);
-        mActive = false;
     }
 
     return err;
@@ -917,18 +1447,24 @@ static status_t s_close(alsa_handle_t *handle)
 */
 static status_t s_standby(alsa_handle_t *handle)
 {
+    AlsaOpTimer timer(ALSA_OP_STANDBY);
+    alsaTrace(ALSA_TRACE_STANDBY, handle->curDev, 0);
     status_t err = NO_ERROR;
     snd_pcm_t *h = handle->handle;
+    if (handle == fmLoopback.playback)
+        fmLoopback.playback = NULL;
     handle->handle = 0;
     ALOGV("In omap4 standby\n");
     if (h) {
-        snd_pcm_drain(h);
-        err = snd_pcm_close(h);
+        alsa_stats_session_t session;
+        alsaStatsClose(handle, &session);
+        const open_state_t *opened = openState(handle);
+        adaptiveUpdate(handle, h, session);
+        err = alsaDrainClose(handle, h, opened->device, opened->stages);
         ALOGV("snd_pcm_close(%p): %s(%d) ", h,
              err != 0 ? strerror(err) : "no error",
              err != 0 ? err : 0);
-        mActive = false;
-        ALOGE("called drain&close\n");
+        ALOGV("called drain&close\n");
     }
 
     return err;
@@ -936,18 +1472,33 @@ static status_t s_standby(alsa_handle_t *handle)
 
 static status_t s_route(alsa_handle_t *handle, uint32_t devices, int mode)
 {
+    AlsaOpTimer timer(ALSA_OP_ROUTE);
+    alsaTrace(ALSA_TRACE_ROUTE, devices, mode);
     status_t status = NO_ERROR;
 
     ALOGD("route called for devices %08x in mode %d...", devices, mode);
 
+    if (handle->handle)
+        alsaStatsSample(handle);
+
     if (!devices) {
-        fm_enable = false;
+        if (fmLoopback.enabled)
+            fmLoopbackStop();
         ALOGV("Ignore the audio routing change as there's no device specified");
         return NO_ERROR;
     }
 
-    if (handle->curDev != devices) {
-        if (mActive) {
+    // while FM Rx runs, the playback handle clocking McPDM DL is switched
+    // by mixer changes alone; it is only opened if nothing clocks DL yet
+    bool fmPlayback = fmLoopback.enabled &&
+                      (direction(handle) == SND_PCM_STREAM_PLAYBACK);
+
+    if (fmPlayback && !handle->handle) {
+        status = s_open(handle, devices, mode, handle->curChannels);
+    } else if (handle->curDev != devices) {
+        // the LP and FIFO paths can be open at the same time: only reopen
+        // this handle if it is the one currently running
+        if (handle->handle && !fmPlayback) {
             status = s_open(handle, devices, mode, handle->curChannels);
         } else {
 #ifdef AUDIO_MODEM_TI
@@ -957,13 +1508,13 @@ static status_t s_route(alsa_handle_t *handle, uint32_t devices, int mode)
 #ifdef AUDIO_MODEM_TI
             audioModem->voiceCallControlsMutexUnlock();
 #endif
+            if (fmPlayback)
+                fmLoopbackTrigger(handle);
         }
-    }else if (fm_enable) {
-        /* FM Rx requires re-opening of playback path
-         * for FM Rx mixer settings to come into effect
-         * else FM Rx audio is not heard
-         */
-         status = s_open(handle, devices, mode, handle->curChannels);
+    } else if (fmPlayback) {
+        // same devices: the mixer is already right, just make sure DL
+        // is still clocked (e.g. after an underrun)
+        fmLoopbackTrigger(handle);
     }
 
 #ifdef AUDIO_MODEM_TI
@@ -978,9 +1529,8 @@ static status_t s_voicevolume(float volume)
     status_t status = NO_ERROR;
 
 #ifdef AUDIO_MODEM_TI
-        ALSAControl control("hw:00");
         if (audioModem) {
-            status = audioModem->voiceCallVolume(&control, volume);
+            status = audioModem->voiceCallVolume(volume);
         } else {
             ALOGE("Audio Modem not initialized: voice volume can't be applied");
             status = NO_INIT;
@@ -998,6 +1548,23 @@ static status_t s_set(const String8& keyValuePairs)
     unsigned int i = 0;
 
     ALOGI("set:: %s", keyValuePairs.string());
+
+    // screen state drives the "Auto" power mode, see deviceName()
+    if (p.get((String8)SCREEN_STATE_KEY, value) == NO_ERROR) {
+        screen_off = (value == (String8)"off");
+        p.remove((String8)SCREEN_STATE_KEY);
+    }
+
+    if (p.get((String8)ALSA_STATS_KEY, value) == NO_ERROR) {
+        alsaStatsDump();
+        p.remove((String8)ALSA_STATS_KEY);
+    }
+
+    if (p.get((String8)ALSA_TRACE_KEY, value) == NO_ERROR) {
+        alsaTraceDump();
+        p.remove((String8)ALSA_TRACE_KEY);
+    }
+
     while (i < propMgr.size()) {
         if (p.get(propMgr.mParams.keyAt(i), value) == NO_ERROR) {
             if(propMgr.set(propMgr.mParams.keyAt(i), value) == BAD_VALUE) {
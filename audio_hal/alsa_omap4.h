@@ -32,6 +32,8 @@
 #define FM_CAPTURE_DEVICE     "plughw:0,1"
 #define MM_LP_DEVICE          "hw:0,6"
 #define HDMI_DEVICE	          "plughw:0,7"
+// speaker/headset and HDMI fed from one stream, defined in alsa_omap4.cpp
+#define DUPLICATE_DEVICE      "omap4_duplicate"
 
 // omap4 outputs/inputs
 #define OMAP4_OUT_SCO      (\
@@ -75,6 +77,42 @@
 #define MM_LP_SAMPLE_RATE 44100        // in Hz
 #endif
 
+// deep buffer profile on MM_LP_DEVICE: two long periods so the ABE
+// ping-pong DMA wakes the MPU as rarely as possible
+#define MM_LP_BUFFER_SIZE     16384    // in frames
+// in usec, the LP profile runs at ALSA_DEFAULT_SAMPLE_RATE (MM_LP_SAMPLE_RATE
+// is unused), so this is 341333 at 48kHz
+#define MM_LP_LATENCY         ((MM_LP_BUFFER_SIZE * 1000000ULL) / ALSA_DEFAULT_SAMPLE_RATE)
+#define MM_LP_NUM_PERIODS     2
+
+// "Adaptive" power mode: the FIFO buffer starts at the latency target,
+// doubles after a session that underran and shrinks by a quarter after
+// ADAPTIVE_SHRINK_RUNS sessions where the writer kept well ahead
+#define ADAPTIVE_LATENCY_TARGET  "20000"  // in usec, default target
+#define ADAPTIVE_MAX_FACTOR      8        // never grow past 8x the target
+#define ADAPTIVE_SHRINK_RUNS     3
+#define ADAPTIVE_MIN_PERIOD_TIME 5000     // in usec, smaller periods use 2 per buffer
+
+// "LowLatency" capture mode: short periods so the blocking read returns
+// after each one, keeping the input latency under 20ms
+#define LL_CAPTURE_PERIOD_TIME   5000     // in usec
+#define LL_CAPTURE_NUM_PERIODS   4
+
+// VXREC media/tones gain of the VoIP echo reference, 0dB
+#define ECHO_REF_VOLUME          120
+
+// gain of the FM capture path into the DL1/DL2 mixers during FM Rx
+#define FM_LOOPBACK_VOLUME       115
+
+// key sent by the framework on screen on/off, used by the "Auto" power mode
+#define SCREEN_STATE_KEY      "screen_state"
+
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 
+namespace android
+{
+// true if the output routing of the media streams writes mixer control 'name'
+bool outputRouteControl(const char *name);
+};
+
 #endif    // ANDROID_ALSA_OMAP4
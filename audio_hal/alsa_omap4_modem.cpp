@@ -21,10 +21,14 @@
 #include <cutils/properties.h>
 #include <dlfcn.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "AudioHardwareALSA.h"
 #include <media/AudioRecord.h>
 #include "alsa_omap4.h"
+#include "audio_modem_null.h"
+#include "alsa_omap_stats.h"
+#include "alsa_omap_trace.h"
 
 namespace android
 {
@@ -50,14 +54,41 @@ voiceCallVolumeProp[] = {
     VOICE_CALL_VOLUME_PROP(0, "")
 };
 
+// Mixer value of each volume step, one curve per distinct volume control
+static voiceCallVolumeCurve voiceCallVolumeCurves[ARRAY_SIZE(voiceCallVolumeProp)];
+static int voiceCallVolumeCurveCount;
+
+// Several devices share a volume control: each control gets one curve,
+// holding the value the old per-call arithmetic gave at every step
+static void voiceCallVolumeCurveInit(const char *volumeName,
+                                     const voiceCallVolumeInfo *info)
+{
+    voiceCallVolumeCurve *curve;
+
+    for (int i = 0; i < voiceCallVolumeCurveCount; i++) {
+        if (!strcmp(voiceCallVolumeCurves[i].volumeName, volumeName))
+            return;
+    }
+
+    curve = &voiceCallVolumeCurves[voiceCallVolumeCurveCount++];
+    curve->volumeName = volumeName;
+    curve->lastValue = -1;
+    for (int step = 0; step < VOICE_CALL_VOLUME_STEPS; step++) {
+        float volume = (float)step / (VOICE_CALL_VOLUME_STEPS - 1);
+        unsigned int value = info->min + volume * (info->max - info->min);
+
+        // Make sure volume is between bounds.
+        if (value > info->max) value = info->max;
+        if (value < info->min) value = info->min;
+        curve->values[step] = value;
+    }
+}
+
 #define WORKAROUND_AVOID_VOICE_VOLUME_MAX   1
 #define WORKAROUND_MAX_VOICE_VOLUME         120
 #define WORKAROUND_AVOID_VOICE_VOLUME_MIN   1
 #define WORKAROUND_MIN_VOICE_VOLUME         90
 
-// Pointer to Thread local info
-voiceCallControlLocalInfo    *mInfo;
-
 // Properties manager
 Omap4ALSAManager propModemMgr;
 // ----------------------------------------------------------------------------
@@ -67,6 +98,144 @@ Omap4ALSAManager propModemMgr;
                                 return error; \
                             }
 #define mAlsaControl mInfo->mAlsaControl
+
+// ----------------------------------------------------------------------------
+// Voice call codec profiles: the playback path and uplink gain of each audio
+// modem mode, in the order they are written. The capture route depends on
+// the mics in use and is set by voiceCallCodecCaptureSet() instead.
+static const AudioModemAlsa::voiceCallCodecControl codecHandset[] = {
+    { "EP Playback", "On", 0, 0 },
+    { "Earphone Playback Volume", NULL, AUDIO_CODEC_EARPIECE_GAIN, -1 },
+    { "DL1 Mono Mixer", NULL, 1, -1 },
+    { "DL1 Mixer Voice", NULL, 1, -1 },
+    { "Sidetone Mixer Playback", NULL, 1, -1 },
+    { "DL1 PDM Switch", NULL, 1, -1 },
+    { "SDT DL Volume", NULL, AUDIO_ABE_SIDETONE_DL_VOL_HANDSET, -1 },
+    { "AUDUL Voice UL Volume", NULL, AUDIO_ABE_AUDUL_VOICE_VOL_HANDSET, -1 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const AudioModemAlsa::voiceCallCodecControl codecHandfree[] = {
+    { "HF Left Playback", "HF DAC", 0, 0 },
+    { "HF Right Playback", "HF DAC", 0, 0 },
+    { "Handsfree Playback Volume", NULL, AUDIO_CODEC_HANDFREE_GAIN, -1 },
+    { "DL2 Mono Mixer", NULL, 1, -1 },
+    { "DL2 Mixer Voice", NULL, 1, -1 },
+    { "SDT DL Volume", NULL, AUDIO_ABE_SIDETONE_DL_VOL_HANDFREE, -1 },
+    { "AUDUL Voice UL Volume", NULL, AUDIO_ABE_AUDUL_VOICE_VOL_HANDFREE, -1 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const AudioModemAlsa::voiceCallCodecControl codecHeadset[] = {
+    { "HS Left Playback", "HS DAC", 0, 0 },
+    { "HS Right Playback", "HS DAC", 0, 0 },
+    { "Headset Playback Volume", NULL, AUDIO_CODEC_HEADSET_GAIN, -1 },
+    { "DL1 Mono Mixer", NULL, 1, -1 },
+    { "DL1 Mixer Voice", NULL, 1, -1 },
+    { "Sidetone Mixer Playback", NULL, 1, -1 },
+    { "DL1 PDM Switch", NULL, 1, -1 },
+    { "SDT DL Volume", NULL, AUDIO_ABE_SIDETONE_DL_VOL_HEADSET, -1 },
+    { "AUDUL Voice UL Volume", NULL, AUDIO_ABE_AUDUL_VOICE_VOL_HEADSET, -1 },
+    { NULL, NULL, 0, 0 }
+};
+
+#ifdef AUDIO_BLUETOOTH
+static const AudioModemAlsa::voiceCallCodecControl codecBluetooth[] = {
+    { "DL1 Mono Mixer", NULL, 1, -1 },
+    { "DL1 Mixer Voice", NULL, 1, -1 },
+    { "Sidetone Mixer Playback", NULL, 1, -1 },
+    { "SDT DL Volume", NULL, AUDIO_ABE_SIDETONE_DL_VOL_BLUETOOTH, -1 },
+    { "AUDUL Voice UL Volume", NULL, AUDIO_ABE_AUDUL_VOICE_VOL_BLUETOOTH, -1 },
+    { "DL1 PDM Switch", NULL, 0, 0 },
+    { "DL1 BT_VX Switch", NULL, 1, -1 },
+    { NULL, NULL, 0, 0 }
+};
+#endif
+
+// written when leaving a profile for one that doesn't use the same ABE mixer
+static const AudioModemAlsa::voiceCallCodecControl codecReleaseDL1[] = {
+    { "DL1 Mixer Voice", NULL, 0, 0 },
+    { "DL1 Mono Mixer", NULL, 0, 0 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const AudioModemAlsa::voiceCallCodecControl codecReleaseDL2[] = {
+    { "DL2 Mixer Voice", NULL, 0, 0 },
+    { "DL2 Mono Mixer", NULL, 0, 0 },
+    { NULL, NULL, 0, 0 }
+};
+
+// in the order voiceCallCodecProfileFind() tries them, 'shared' is set at init
+static AudioModemAlsa::voiceCallCodecProfile codecProfiles[] = {
+    { AudioModemInterface::AUDIO_MODEM_HANDSET, codecHandset, codecReleaseDL1, 0 },
+    { AudioModemInterface::AUDIO_MODEM_HANDFREE, codecHandfree, codecReleaseDL2, 0 },
+    { AudioModemInterface::AUDIO_MODEM_HEADSET, codecHeadset, codecReleaseDL1, 0 },
+#ifdef AUDIO_BLUETOOTH
+    { AudioModemInterface::AUDIO_MODEM_BLUETOOTH, codecBluetooth, codecReleaseDL1, 0 },
+#endif
+};
+
+static const AudioModemAlsa::voiceCallCodecControl *codecControlFind(
+                    const AudioModemAlsa::voiceCallCodecControl *ctl, const char *name)
+{
+    for (; ctl->name; ctl++) {
+        if (!strcmp(ctl->name, name))
+            return ctl;
+    }
+    return NULL;
+}
+
+static bool codecControlSame(const AudioModemAlsa::voiceCallCodecControl *a,
+                             const AudioModemAlsa::voiceCallCodecControl *b)
+{
+    if (a->str || b->str)
+        return a->str && b->str && !strcmp(a->str, b->str);
+    return (a->value == b->value) && (a->index == b->index);
+}
+
+static status_t codecControlSet(ALSAControl *control,
+                                const AudioModemAlsa::voiceCallCodecControl *ctl)
+{
+    if (ctl->str)
+        return control->set(ctl->name, ctl->str);
+    return control->set(ctl->name, ctl->value, ctl->index);
+}
+
+// A control the output routing also writes may no longer hold the value
+// the previous profile gave it, so a route change always rewrites it
+static void voiceCallCodecProfilesInit()
+{
+    for (size_t i = 0; i < ARRAY_SIZE(codecProfiles); i++) {
+        const AudioModemAlsa::voiceCallCodecControl *ctl = codecProfiles[i].controls;
+
+        codecProfiles[i].shared = 0;
+        for (int j = 0; ctl[j].name; j++) {
+            if (outputRouteControl(ctl[j].name))
+                codecProfiles[i].shared |= 1 << j;
+        }
+    }
+}
+
+// Modem step run by voiceCallModemCodecSteps() on its helper thread
+struct voiceCallModemJob
+{
+    AudioModemAlsa  *modem;
+    AudioModemAlsa::voiceCallStep_t step;
+    status_t        error;
+    nsecs_t         duration;
+};
+
+// Accounts the voice call step that started at *step to 'op' and starts
+// the next one. Codec steps include the wait for the codec mutex.
+static nsecs_t voiceCallStepTime(int op, nsecs_t *step)
+{
+    nsecs_t now = systemTime();
+    nsecs_t duration = now - *step;
+
+    alsaStatsOpTime(op, duration);
+    *step = now;
+    return duration;
+}
 // ----------------------------------------------------------------------------
 #if !LOG_NDEBUG
 // Mutex counter for debug
@@ -78,27 +247,22 @@ extern "C"
         ALOGV("%s",__FUNCTION__);
         AudioModemAlsa *mAudioModemAlsa = (AudioModemAlsa * )_mAudioModemAlsa;
         mAudioModemAlsa->voiceCallControlsThread();
-        delete mAudioModemAlsa;
         return (NULL);
     }
 
-    static pthread_key_t   mVoiceCallControlThreadKey;
-    void voiceCallControlInitThreadOnce(void)
-    {
-        status_t error = NO_ERROR;
-        ALOGV("%s",__FUNCTION__);
-        error = pthread_key_create(&mVoiceCallControlThreadKey,
-                                    NULL);
-        if (error != NO_ERROR) {
-            ALOGE("Can't create the Voice Call Control Thread key");
-            exit(error);
-        }
+    void *VoiceCallModemStepStartup(void *_job) {
+        voiceCallModemJob *job = (voiceCallModemJob *)_job;
+        nsecs_t start = systemTime();
+
+        job->error = (job->modem->*job->step)();
+        job->duration = systemTime() - start;
+        return (NULL);
     }
 }
 // ----------------------------------------------------------------------------
 AudioModemAlsa::AudioModemAlsa()
 {
-    status_t error;
+    status_t error = NO_ERROR;
     pthread_attr_t  mVoiceCallControlAttr;
 
     ALOGV("Build date: %s time: %s", __DATE__, __TIME__);
@@ -112,17 +276,26 @@ AudioModemAlsa::AudioModemAlsa()
         if (error != NO_ERROR) {
             ALOGE("Audio Modem Interface was not correctly initialized.");
             delete mModem;
-            exit(error);
+            mModem = new AudioModemNull();
+            error = NO_ERROR;
         }
     }
     else {
         ALOGE("No Audio Modem Interface found.");
-        exit(-1);
+        mModem = new AudioModemNull();
     }
     mVoiceCallState = AUDIO_MODEM_VOICE_CALL_OFF;
 
-    // Initialize Min and Max volume
+    voiceCallCodecProfilesInit();
+
+    // Control opened once for the voice volume, which can change often
+    mVolumeControl = new ALSAControl("hw:00");
+
+    // Initialize Min and Max volume. A board without the mixer controls
+    // still comes up, voiceCallVolume() then reports the failure
     int i = 0;
+    voiceCallVolumeCurveCount = 0;
+    mVolumeInitStatus = NO_ERROR;
     while(voiceCallVolumeProp[i].device) {
         voiceCallVolumeInfo *info = voiceCallVolumeProp[i].mInfo = new voiceCallVolumeInfo;
 
@@ -131,29 +304,28 @@ AudioModemAlsa::AudioModemAlsa()
                 voiceCallVolumeProp[i].volumeName, WORKAROUND_MAX_VOICE_VOLUME);
         info->max = WORKAROUND_MAX_VOICE_VOLUME;
 #else
-        error = alsaControl->getmax(voiceCallVolumeProp[i].volumeName, info->max);
+        error = mVolumeControl->getmax(voiceCallVolumeProp[i].volumeName, info->max);
 #endif
 #if WORKAROUND_AVOID_VOICE_VOLUME_MIN
         ALOGV("Workaround: Voice call min volume name %s limited to: %d",
                 voiceCallVolumeProp[i].volumeName, WORKAROUND_MIN_VOICE_VOLUME);
         info->min = WORKAROUND_MIN_VOICE_VOLUME;
 #else
-        error = alsaControl->getmin(voiceCallVolumeProp[i].volumeName, info->min);
+        error = mVolumeControl->getmin(voiceCallVolumeProp[i].volumeName, info->min);
 #endif
         ALOGV("Voice call volume name: %s min: %d max: %d", voiceCallVolumeProp[i].volumeName,
                  info->min, info->max);
 
         if (error != NO_ERROR) {
-            ALOGE("Audio Voice Call volume was not correctly initialized.");
-            delete mModem;
-            exit(error);
+            ALOGE("Audio Voice Call volume %s was not correctly initialized.",
+                  voiceCallVolumeProp[i].volumeName);
+            mVolumeInitStatus = error;
+        } else {
+            voiceCallVolumeCurveInit(voiceCallVolumeProp[i].volumeName, info);
         }
         i++;
     }
 
-    // Initialize voice call control key once
-    mVoiceCallControlKeyOnce = PTHREAD_ONCE_INIT;
-
     // Initialize voice call control mutex
     pthread_mutex_init(&mVoiceCallControlMutex, NULL);
 
@@ -162,23 +334,35 @@ AudioModemAlsa::AudioModemAlsa()
     // new param is available
     pthread_cond_init(&mVoiceCallControlNewParams, NULL);
 
+    // Signaled by the Voice call control thread when it exits
+    pthread_cond_init(&mVoiceCallControlExit, NULL);
+
     // Initialize and set thread detached attribute
     pthread_attr_init(&mVoiceCallControlAttr);
     pthread_attr_setdetachstate(&mVoiceCallControlAttr, PTHREAD_CREATE_JOINABLE);
 
     voiceCallControlsMutexLock();
-    mVoiceCallControlMainInfo.updateFlag = false;
+    mVoiceCallControlHead = 0;
+    mVoiceCallControlCount = 0;
+    mVoiceCallControlLast.devices = 0;
+    mVoiceCallControlLast.mode = AudioSystem::MODE_INVALID;
+    mVoiceCallControlLast.multimediaUpdate = false;
+    mVoiceCallControlStop = false;
+    mVoiceCallControlExited = false;
     voiceCallControlsMutexUnlock();
 
-    // Create thread for voice control
+    // Create thread for voice control. Without it no call can be routed,
+    // but the media path still comes up: initCheck() reports the failure
     error = pthread_create(&mVoiceCallControlThread, &mVoiceCallControlAttr,
                             VoiceCallControlsThreadStartup, (void *)this);
-    if (error != NO_ERROR) {
-        ALOGE("Error creating mVoiceCallControlThread");
-        delete mModem;
-        exit(error);
-    }
     pthread_attr_destroy(&mVoiceCallControlAttr);
+    mVoiceCallControlRunning = (error == 0);
+    if (error != 0) {
+        ALOGE("Error creating mVoiceCallControlThread: %s", strerror(error));
+        mInitStatus = NO_INIT;
+    } else {
+        mInitStatus = NO_ERROR;
+    }
 
     // Properties manager init
     propModemMgr = Omap4ALSAManager();
@@ -213,11 +397,70 @@ AudioModemAlsa::AudioModemAlsa()
 AudioModemAlsa::~AudioModemAlsa()
 {
     ALOGD("Destroy devices for Modem OMAP4 ALSA module");
+
+    // the owner stops the thread first, and leaks the object if it can't
+    ALOGE_IF(voiceCallControlsStop() != NO_ERROR,
+             "Voice call control thread left running on a deleted modem");
+
+    pthread_cond_destroy(&mVoiceCallControlExit);
+    pthread_cond_destroy(&mVoiceCallControlNewParams);
+    pthread_mutex_destroy(&mVoiceCallControlMutex);
+
+    for (size_t i = 0; i < mDevicePropList.size(); i++)
+        delete mDevicePropList.valueAt(i);
     mDevicePropList.clear();
+    for (int i = 0; voiceCallVolumeProp[i].device; i++) {
+        delete voiceCallVolumeProp[i].mInfo;
+        voiceCallVolumeProp[i].mInfo = NULL;
+    }
     if (mModem) delete mModem;
+    delete mVolumeControl;
+}
 
-    pthread_mutex_destroy(&mVoiceCallControlMutex);
-    pthread_kill(mVoiceCallControlThread, SIGKILL);
+status_t AudioModemAlsa::initCheck()
+{
+    return mInitStatus;
+}
+
+// Asks the control thread to leave any call in progress and exit, then
+// joins it. The thread only stops between two commands: if a modem step
+// holds it past the timeout it is detached instead and TIMED_OUT returned,
+// in which case the object is still in use and must not be deleted.
+status_t AudioModemAlsa::voiceCallControlsStop()
+{
+    nsecs_t start = systemTime();
+    struct timespec deadline;
+    bool exited;
+    int error = 0;
+
+    if (!mVoiceCallControlRunning)
+        return NO_ERROR;
+
+    voiceCallControlsMutexLock();
+    mVoiceCallControlStop = true;
+    pthread_cond_signal(&mVoiceCallControlNewParams);
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += VOICE_CALL_CONTROL_STOP_TIMEOUT;
+    while (!mVoiceCallControlExited && (error != ETIMEDOUT)) {
+        error = pthread_cond_timedwait(&mVoiceCallControlExit, &mVoiceCallControlMutex,
+                                       &deadline);
+    }
+    exited = mVoiceCallControlExited;
+    voiceCallControlsMutexUnlock();
+
+    mVoiceCallControlRunning = false;
+    if (!exited) {
+        ALOGE("Voice call control thread still busy after %ds, leaving it behind",
+              VOICE_CALL_CONTROL_STOP_TIMEOUT);
+        pthread_detach(mVoiceCallControlThread);
+        return TIMED_OUT;
+    }
+
+    // it has signaled its exit, all that is left is returning
+    pthread_join(mVoiceCallControlThread, NULL);
+    ALOGD("Voice call control thread stopped in %lldus",
+          (long long)ns2us(systemTime() - start));
+    return NO_ERROR;
 }
 
 AudioModemInterface* AudioModemAlsa::create()
@@ -230,19 +473,25 @@ AudioModemInterface* AudioModemAlsa::create()
                  libPath,
                  AUDIO_MODEM_LIB_DEFAULT_PATH);
 
+    if (!strcmp(libPath, AUDIO_MODEM_NULL_PATH))
+        return(new AudioModemNull());
+
     ALOGW_IF(!strcmp(libPath, AUDIO_MODEM_LIB_DEFAULT_PATH),
                     "Use generic Modem interface");
 
+    // Without its modem library the HAL still has to come up: fall back
+    // to the null modem rather than taking the media server down with it
     dlHandle = dlopen(libPath, RTLD_NOW);
     if (dlHandle == NULL) {
         ALOGE("Audio Modem %s dlopen failed: %s", libPath, dlerror());
-        exit(-1);
+        return(new AudioModemNull());
     }
 
     audioModem = (AudioModemInterface *(*)(void))dlsym(dlHandle, "createAudioModemInterface");
     if (audioModem == NULL) {
         ALOGE("createAudioModemInterface function not defined or not exported in %s", libPath);
-        exit(-1);
+        dlclose(dlHandle);
+        return(new AudioModemNull());
     }
 
     return(audioModem());
@@ -323,23 +572,78 @@ status_t AudioModemAlsa::voiceCallControls(uint32_t devices, int mode, bool mult
 {
     ALOGV("%s: devices %04x mode %d MultimediaUpdate %d", __FUNCTION__, devices, mode, multimediaUpdate);
 
+    if (mInitStatus != NO_ERROR)
+        return mInitStatus;
+
     // Ignore input devices
     if (!(devices & AudioSystem::DEVICE_IN_ALL)) {
-        if ((mVoiceCallControlMainInfo.devices != devices) ||
-            (mVoiceCallControlMainInfo.mode != mode) ||
+        voiceCallControlsMutexLock();
+        if ((mVoiceCallControlLast.devices != devices) ||
+            (mVoiceCallControlLast.mode != mode) ||
             (multimediaUpdate)) {
-            voiceCallControlsMutexLock();
-            mVoiceCallControlMainInfo.devices = devices;
-            mVoiceCallControlMainInfo.mode = mode;
-            mVoiceCallControlMainInfo.updateFlag = true;
-            mVoiceCallControlMainInfo.multimediaUpdate = multimediaUpdate;
-            voiceCallControlsMutexUnlock();
+            voiceCallControlsQueueLocked(devices, mode, multimediaUpdate);
             pthread_cond_signal(&mVoiceCallControlNewParams);
         }
+        voiceCallControlsMutexUnlock();
     }
     return NO_ERROR;
 }
 
+void AudioModemAlsa::voiceCallControlsQueueLocked(uint32_t devices, int mode,
+                                                  bool multimediaUpdate)
+{
+    voiceCallControlMainInfo *tail = NULL;
+    bool inCall = (mode == AudioSystem::MODE_IN_CALL);
+
+    if (mVoiceCallControlCount) {
+        tail = &mVoiceCallControlQueue[(mVoiceCallControlHead + mVoiceCallControlCount - 1) %
+                                        VOICE_CALL_CONTROL_QUEUE_SIZE];
+
+        if ((tail->mode == AudioSystem::MODE_IN_CALL) != inCall) {
+            if (mVoiceCallControlCount < VOICE_CALL_CONTROL_QUEUE_SIZE) {
+                tail = NULL;
+            } else {
+                // Full: the tail and this command would go into the call
+                // and out again (or the reverse) before the thread even gets
+                // there, so drop that round trip and merge with the one before
+                ALOGW("%s: voice call queue full, dropping mode %d",
+                        __FUNCTION__, tail->mode);
+                mVoiceCallControlCount--;
+                tail = &mVoiceCallControlQueue[(mVoiceCallControlHead + mVoiceCallControlCount - 1) %
+                                                VOICE_CALL_CONTROL_QUEUE_SIZE];
+            }
+        }
+    }
+
+    if (tail) {
+        // same call state: only the latest route matters
+        tail->devices = devices;
+        tail->mode = mode;
+        tail->multimediaUpdate |= multimediaUpdate;
+    } else {
+        tail = &mVoiceCallControlQueue[(mVoiceCallControlHead + mVoiceCallControlCount) %
+                                        VOICE_CALL_CONTROL_QUEUE_SIZE];
+        tail->devices = devices;
+        tail->mode = mode;
+        tail->multimediaUpdate = multimediaUpdate;
+        tail->queued = systemTime();
+        mVoiceCallControlCount++;
+    }
+
+    mVoiceCallControlLast = *tail;
+}
+
+bool AudioModemAlsa::voiceCallControlsDequeueLocked(voiceCallControlMainInfo *command)
+{
+    if (!mVoiceCallControlCount)
+        return false;
+
+    *command = mVoiceCallControlQueue[mVoiceCallControlHead];
+    mVoiceCallControlHead = (mVoiceCallControlHead + 1) % VOICE_CALL_CONTROL_QUEUE_SIZE;
+    mVoiceCallControlCount--;
+    return true;
+}
+
 void AudioModemAlsa::voiceCallControlsMutexLock(void)
 {
     ALOGV("%s: %d", __FUNCTION__, ++voiceCallControlMutexCount);
@@ -356,47 +660,32 @@ void AudioModemAlsa::voiceCallControlsThread(void)
 {
     status_t error = NO_ERROR;
     ALSAControl alsaControl("hw:00");
+    voiceCallControlLocalInfo info;
+    voiceCallControlMainInfo command;
+    nsecs_t start, step, modemTime, codecTime, linkTime;
 
-    error = pthread_once(&mVoiceCallControlKeyOnce,
-                           voiceCallControlInitThreadOnce);
-    if (error != NO_ERROR) {
-        ALOGE("Error in voiceCallControlInitThreadOnce");
-        goto exit;
-    }
-
-    mInfo = (voiceCallControlLocalInfo *)malloc(sizeof(voiceCallControlLocalInfo));
-    if (mInfo == NULL) {
-        ALOGE("Error allocating mVoiceCallControlThreadInfo");
-        error = NO_MEMORY;
-        goto exit;
-    }
-
-    error = pthread_setspecific(mVoiceCallControlThreadKey, mInfo);
-    if (error != NO_ERROR) {
-        ALOGE("Error in Voice Call info set specific");
-        goto exit;
-    }
-
+    // Only this thread sets or reads mInfo after this point
+    mInfo = &info;
     mInfo->devices = 0;
     mInfo->mode = AudioSystem::MODE_INVALID;
     mAlsaControl = &alsaControl;
 
     for (;;) {
         voiceCallControlsMutexLock();
-        // Wait for new parameters
-        if (!mVoiceCallControlMainInfo.updateFlag) {
+        // Wait for new parameters, one command at a time, or for the stop
+        while (!mVoiceCallControlStop && !voiceCallControlsDequeueLocked(&command)) {
             pthread_cond_wait(&mVoiceCallControlNewParams, &mVoiceCallControlMutex);
         }
-        mVoiceCallControlMainInfo.updateFlag = false;
-        mInfo = (voiceCallControlLocalInfo *)pthread_getspecific(mVoiceCallControlThreadKey);
-        if (mInfo == NULL) {
-            ALOGE("Error in Voice Call info get specific");
-            goto exit;
+        if (mVoiceCallControlStop) {
+            voiceCallControlsMutexUnlock();
+            break;
         }
-        mInfo->devices = mVoiceCallControlMainInfo.devices;
-        mInfo->mode = mVoiceCallControlMainInfo.mode;
-        mInfo->multimediaUpdate = mVoiceCallControlMainInfo.multimediaUpdate;
         voiceCallControlsMutexUnlock();
+        start = systemTime();
+        modemTime = codecTime = linkTime = 0;
+        mInfo->devices = command.devices;
+        mInfo->mode = command.mode;
+        mInfo->multimediaUpdate = command.multimediaUpdate;
         ALOGV("%s: devices %04x mode %d forceUpdate %d", __FUNCTION__, mInfo->devices, mInfo->mode,
                                                                     mInfo->multimediaUpdate);
 
@@ -410,13 +699,20 @@ void AudioModemAlsa::voiceCallControlsThread(void)
             error = setCurrentAudioModemModes(mInfo->devices);
             if (error < 0) goto exit;
             mDeviceProp = mDevicePropList.valueFor(mCurrentAudioModemModes);
-            error = voiceCallModemSet();
+            error = voiceCallModemCodecSteps(&AudioModemAlsa::voiceCallModemSet,
+                                             &AudioModemAlsa::voiceCallCodecPathSet,
+                                             &modemTime, &codecTime);
             if (error < 0) goto exit;
+            step = systemTime();
             voiceCallControlsMutexLock();
-            error = voiceCallCodecSet();
+            error = voiceCallCodecLinkSet();
             voiceCallControlsMutexUnlock();
+            linkTime = voiceCallStepTime(ALSA_OP_VOICE_LINK, &step);
             if (error < 0) goto exit;
             mVoiceCallState = AUDIO_MODEM_VOICE_CALL_ON;
+            ALOGI("Voice call setup took %lldus: modem %lldus, codec %lldus, link %lldus",
+                    (long long)ns2us(step - start), (long long)ns2us(modemTime),
+                    (long long)ns2us(codecTime), (long long)ns2us(linkTime));
         } else if ((mInfo->mode == AudioSystem::MODE_IN_CALL) &&
                 (mVoiceCallState == AUDIO_MODEM_VOICE_CALL_ON)) {
             // update in voice call mode
@@ -429,11 +725,15 @@ void AudioModemAlsa::voiceCallControlsThread(void)
             mDevicePropPrevious = mDeviceProp;
             mDeviceProp = mDevicePropList.valueFor(mCurrentAudioModemModes);
             if (mCurrentAudioModemModes != mPreviousAudioModemModes) {
-                error = voiceCallModemUpdate();
+                error = voiceCallModemCodecSteps(&AudioModemAlsa::voiceCallModemUpdate,
+                                                 &AudioModemAlsa::voiceCallCodecPathUpdate,
+                                                 &modemTime, &codecTime);
                 if (error < 0) goto exit;
+                step = systemTime();
                 voiceCallControlsMutexLock();
-                error = voiceCallCodecUpdate();
+                error = voiceCallCodecLinkSet();
                 voiceCallControlsMutexUnlock();
+                linkTime = voiceCallStepTime(ALSA_OP_VOICE_LINK, &step);
                 if (error < 0) goto exit;
             } else if (mInfo->multimediaUpdate) {
                 voiceCallControlsMutexLock();
@@ -448,19 +748,92 @@ void AudioModemAlsa::voiceCallControlsThread(void)
             // we just exit voice call mode
             mPreviousAudioModemModes = 0;
             mCurrentAudioModemModes = 0;
+            step = systemTime();
             error = voiceCallModemReset();
+            modemTime = voiceCallStepTime(ALSA_OP_VOICE_MODEM, &step);
             if (error < 0) goto exit;
             voiceCallControlsMutexLock();
             error = voiceCallCodecReset();
             voiceCallControlsMutexUnlock();
+            codecTime = voiceCallStepTime(ALSA_OP_VOICE_CODEC, &step);
             if (error < 0) goto exit;
             mVoiceCallState = AUDIO_MODEM_VOICE_CALL_OFF;
         }
+
+        alsaStatsOpTime(ALSA_OP_VOICE_CALL, systemTime() - command.queued);
+        ALOGV("%s: mode %d done in %lldus (modem %lldus, codec %lldus, link %lldus) "
+                "after %lldus queued", __FUNCTION__, mInfo->mode,
+                (long long)ns2us(systemTime() - start), (long long)ns2us(modemTime),
+                (long long)ns2us(codecTime), (long long)ns2us(linkTime),
+                (long long)ns2us(start - command.queued));
     } // for(;;)
 
+    // Stopped: commands still queued are dropped, but a call in progress
+    // is left so the modem stream and the modem PCM link get closed
+    if (mVoiceCallState == AUDIO_MODEM_VOICE_CALL_ON) {
+        ALOGI("%s: stopped during a voice call, leaving it", __FUNCTION__);
+        mPreviousAudioModemModes = 0;
+        mCurrentAudioModemModes = 0;
+        error = voiceCallModemReset();
+        voiceCallControlsMutexLock();
+        voiceCallCodecReset();
+        voiceCallControlsMutexUnlock();
+        mVoiceCallState = AUDIO_MODEM_VOICE_CALL_OFF;
+    }
+
 exit:
-    ALOGE("%s: exit with error %d (%s)", __FUNCTION__, error, strerror(error));
-    pthread_exit((void*) error);
+    if (error < 0)
+        ALOGE("%s: exit with error %d (%s)", __FUNCTION__, error, strerror(-error));
+
+    // returning rather than pthread_exit() lets alsaControl close
+    mInfo = NULL;
+    voiceCallControlsMutexLock();
+    mVoiceCallControlExited = true;
+    pthread_cond_signal(&mVoiceCallControlExit);
+    voiceCallControlsMutexUnlock();
+}
+
+// The modem side goes through the modem library while the codec side only
+// programs ALSA controls, and neither needs the other until the PCM link
+// starts. Run the modem step on a helper thread while this thread sets the
+// codec paths, then join: the call setup takes the longer of the two
+// instead of their sum. Both read mDeviceProp and mCurrentAudioModemModes,
+// which stay put until the join. The modem step also writes
+// mVoiceCallSampleRate: the codec path steps never touch it, and the PCM
+// link that reads it is only set up after the join.
+status_t AudioModemAlsa::voiceCallModemCodecSteps(voiceCallStep_t modemStep,
+                                                  voiceCallStep_t codecStep,
+                                                  nsecs_t *modemTime,
+                                                  nsecs_t *codecTime)
+{
+    voiceCallModemJob job;
+    pthread_t thread;
+    bool parallel;
+    nsecs_t step;
+    status_t error;
+
+    job.modem = this;
+    job.step = modemStep;
+    parallel = (pthread_create(&thread, NULL, VoiceCallModemStepStartup, &job) == 0);
+    if (!parallel) {
+        ALOGW("%s: can't create modem step thread, running it inline", __FUNCTION__);
+        VoiceCallModemStepStartup(&job);
+    }
+
+    step = systemTime();
+    voiceCallControlsMutexLock();
+    error = (this->*codecStep)();
+    voiceCallControlsMutexUnlock();
+    *codecTime = voiceCallStepTime(ALSA_OP_VOICE_CODEC, &step);
+
+    if (parallel)
+        pthread_join(thread, NULL);
+    *modemTime = job.duration;
+    alsaStatsOpTime(ALSA_OP_VOICE_MODEM, job.duration);
+
+    if (job.error < 0)
+        return job.error;
+    return error;
 }
 
 status_t AudioModemAlsa::setCurrentAudioModemModes(uint32_t devices)
@@ -489,27 +862,34 @@ status_t AudioModemAlsa::setCurrentAudioModemModes(uint32_t devices)
     return NO_ERROR;
 }
 
-status_t AudioModemAlsa::voiceCallCodecSet()
+// Codec paths of the new route, without the modem PCM link
+status_t AudioModemAlsa::voiceCallCodecPathSet()
 {
     status_t error = NO_ERROR;
 
+    const voiceCallCodecProfile *profile;
+    int written;
+
     ALOGV("Start Audio Codec Voice call: %04x", mCurrentAudioModemModes);
 
-    if (mCurrentAudioModemModes & AudioModemInterface::AUDIO_MODEM_HANDSET) {
-        error = voiceCallCodecSetHandset();
-    } else if (mCurrentAudioModemModes & AudioModemInterface::AUDIO_MODEM_HANDFREE) {
-        error = voiceCallCodecSetHandfree();
-    } else if (mCurrentAudioModemModes & AudioModemInterface::AUDIO_MODEM_HEADSET) {
-        error = voiceCallCodecSetHeadset();
-#ifdef AUDIO_BLUETOOTH
-    } else if (mCurrentAudioModemModes & AudioModemInterface::AUDIO_MODEM_BLUETOOTH) {
-        error = voiceCallCodecSetBluetooth();
-#endif
-    } else {
+    profile = voiceCallCodecProfileFind(mCurrentAudioModemModes);
+    if (!profile) {
         ALOGE("Audio Modem mode not supported: %04x", mCurrentAudioModemModes);
         return INVALID_OPERATION;
     }
 
+    CHECK_ERROR(voiceCallCodecProfileSet(NULL, profile, &written), error);
+    CHECK_ERROR(voiceCallCodecCaptureSet(), error);
+
+    return error;
+}
+
+// Starts the modem PCM link once both the codec paths and the modem are
+// set, as its sample rate comes from the modem side
+status_t AudioModemAlsa::voiceCallCodecLinkSet()
+{
+    status_t error = NO_ERROR;
+
     error = voiceCallCodecPCMSet();
     error = voiceCallSidetoneSet(mCurrentAudioModemModes);
 
@@ -613,51 +993,51 @@ status_t AudioModemAlsa::voiceCallCodecPCMReset()
     return NO_ERROR;
 }
 
-status_t AudioModemAlsa::voiceCallCodecSetHandset()
+const AudioModemAlsa::voiceCallCodecProfile *AudioModemAlsa::voiceCallCodecProfileFind(uint32_t modes)
 {
-    status_t error = NO_ERROR;
-    String8 keyMain = (String8)Omap4ALSAManager::MAIN_MIC;
-    String8 keySub = (String8)Omap4ALSAManager::SUB_MIC;
-    String8 main;
-    String8 sub;
-
-    // Enable Playback voice path
-    CHECK_ERROR(mAlsaControl->set("EP Playback", "On"), error);
-    CHECK_ERROR(mAlsaControl->set("Earphone Playback Volume", AUDIO_CODEC_EARPIECE_GAIN), error);
-    CHECK_ERROR(mAlsaControl->set("DL1 Mono Mixer", 1), error);
-    CHECK_ERROR(mAlsaControl->set("DL1 Mixer Voice", 1), error);
-    CHECK_ERROR(mAlsaControl->set("Sidetone Mixer Playback", 1), error);
-    CHECK_ERROR(mAlsaControl->set("DL1 PDM Switch", 1), error);
-    CHECK_ERROR(mAlsaControl->set("SDT DL Volume",
-                                AUDIO_ABE_SIDETONE_DL_VOL_HANDSET, -1), error);
-    // Enable Capture voice path
-    CHECK_ERROR(propModemMgr.get(keyMain, main), error);
-    CHECK_ERROR(propModemMgr.get(keySub, sub), error);
-    if ((strncmp(main.string(), "A", 1) == 0) ||
-        (strncmp(sub.string(), "A", 1) == 0)) {
-        CHECK_ERROR(mAlsaControl->set("Analog Left Capture Route", "Main Mic"), error);
-        if (!strcmp(mDeviceProp->settingsList[AUDIO_MODEM_VOICE_CALL_MULTIMIC].name,
-                    "Yes")) {
-            ALOGV("dual mic. enabled");
+    for (size_t i = 0; i < ARRAY_SIZE(codecProfiles); i++) {
+        if (modes & codecProfiles[i].modes)
+            return &codecProfiles[i];
+    }
+    return NULL;
+}
 
-            // Enable Sub mic
-            CHECK_ERROR(mAlsaControl->set("Analog Right Capture Route", "Sub Mic"),
-                                            error);
+// Writes the controls of 'to'. Coming from the 'from' profile in a call, the
+// controls 'from' set and 'to' doesn't are released first, and a control
+// both set to the same value is skipped unless the output routing may have
+// changed it since. Returns the number of controls written in 'written'.
+status_t AudioModemAlsa::voiceCallCodecProfileSet(const voiceCallCodecProfile *from,
+                                                  const voiceCallCodecProfile *to,
+                                                  int *written)
+{
+    status_t error = NO_ERROR;
+    const voiceCallCodecControl *ctl, *prev;
+
+    *written = 0;
+    if (from) {
+        for (ctl = from->release; ctl->name; ctl++) {
+            if (codecControlFind(to->controls, ctl->name))
+                continue;
+            CHECK_ERROR(codecControlSet(mAlsaControl, ctl), error);
+            (*written)++;
         }
-        CHECK_ERROR(mAlsaControl->set("Capture Preamplifier Volume",
-                                    AUDIO_CODEC_CAPTURE_PREAMP_ATT_HANDSET, -1), error);
-        CHECK_ERROR(mAlsaControl->set("Capture Volume",
-                                    AUDIO_CODEC_CAPTURE_VOL_HANDSET, -1), error);
     }
-    CHECK_ERROR(mAlsaControl->set("AUDUL Voice UL Volume",
-                                AUDIO_ABE_AUDUL_VOICE_VOL_HANDSET, -1), error);
-    CHECK_ERROR(configMicrophones(), error);
-    CHECK_ERROR(configEqualizers(), error);
+
+    for (int i = 0; to->controls[i].name; i++) {
+        ctl = &to->controls[i];
+        prev = from ? codecControlFind(from->controls, ctl->name) : NULL;
+        if (prev && !(to->shared & (1 << i)) && codecControlSame(prev, ctl))
+            continue;
+        CHECK_ERROR(codecControlSet(mAlsaControl, ctl), error);
+        (*written)++;
+    }
 
     return error;
 }
 
-status_t AudioModemAlsa::voiceCallCodecSetHandfree()
+// Capture side of the voice call: the mic routes depend on the mics in use
+// and are always written
+status_t AudioModemAlsa::voiceCallCodecCaptureSet()
 {
     status_t error = NO_ERROR;
     String8 keyMain = (String8)Omap4ALSAManager::MAIN_MIC;
@@ -665,240 +1045,69 @@ status_t AudioModemAlsa::voiceCallCodecSetHandfree()
     String8 main;
     String8 sub;
 
-    // Enable Playback voice path
-    CHECK_ERROR(mAlsaControl->set("HF Left Playback", "HF DAC"), error);
-    CHECK_ERROR(mAlsaControl->set("HF Right Playback", "HF DAC"), error);
-    CHECK_ERROR(mAlsaControl->set("Handsfree Playback Volume", AUDIO_CODEC_HANDFREE_GAIN), error);
-    CHECK_ERROR(mAlsaControl->set("DL2 Mono Mixer", 1), error);
-    CHECK_ERROR(mAlsaControl->set("DL2 Mixer Voice", 1), error);
-    CHECK_ERROR(mAlsaControl->set("SDT DL Volume",
-                                AUDIO_ABE_SIDETONE_DL_VOL_HANDFREE, -1), error);
-
-    // Enable Capture voice path
-    CHECK_ERROR(propModemMgr.get(keyMain, main), error);
-    CHECK_ERROR(propModemMgr.get(keySub, sub), error);
-    if ((strncmp(main.string(), "A", 1) == 0) ||
-        (strncmp(sub.string(), "A", 1) == 0)) {
-        CHECK_ERROR(mAlsaControl->set("Analog Left Capture Route", "Main Mic"), error);
-        if (!strcmp(mDeviceProp->settingsList[AUDIO_MODEM_VOICE_CALL_MULTIMIC].name,
-                    "Yes")) {
-            ALOGV("dual mic. enabled");
-
-            // Enable Sub mic
-            CHECK_ERROR(mAlsaControl->set("Analog Right Capture Route", "Sub Mic"),
-                                            error);
+    if (mCurrentAudioModemModes & (AudioModemInterface::AUDIO_MODEM_HANDSET |
+                                   AudioModemInterface::AUDIO_MODEM_HANDFREE)) {
+        bool handset = mCurrentAudioModemModes & AudioModemInterface::AUDIO_MODEM_HANDSET;
+
+        CHECK_ERROR(propModemMgr.get(keyMain, main), error);
+        CHECK_ERROR(propModemMgr.get(keySub, sub), error);
+        if ((strncmp(main.string(), "A", 1) == 0) ||
+            (strncmp(sub.string(), "A", 1) == 0)) {
+            CHECK_ERROR(mAlsaControl->set("Analog Left Capture Route", "Main Mic"), error);
+            if (!strcmp(mDeviceProp->settingsList[AUDIO_MODEM_VOICE_CALL_MULTIMIC].name,
+                        "Yes")) {
+                ALOGV("dual mic. enabled");
+
+                // Enable Sub mic
+                CHECK_ERROR(mAlsaControl->set("Analog Right Capture Route", "Sub Mic"),
+                                                error);
+            }
+            CHECK_ERROR(mAlsaControl->set("Capture Preamplifier Volume",
+                                        handset ? AUDIO_CODEC_CAPTURE_PREAMP_ATT_HANDSET :
+                                                  AUDIO_CODEC_CAPTURE_PREAMP_ATT_HANDFREE,
+                                        -1), error);
+            CHECK_ERROR(mAlsaControl->set("Capture Volume",
+                                        handset ? AUDIO_CODEC_CAPTURE_VOL_HANDSET :
+                                                  AUDIO_CODEC_CAPTURE_VOL_HANDFREE,
+                                        -1), error);
         }
+    } else if (mCurrentAudioModemModes & AudioModemInterface::AUDIO_MODEM_HEADSET) {
+        CHECK_ERROR(mAlsaControl->set("Analog Left Capture Route", "Headset Mic"), error);
+        CHECK_ERROR(mAlsaControl->set("Analog Right Capture Route", "Headset Mic"), error);
         CHECK_ERROR(mAlsaControl->set("Capture Preamplifier Volume",
-                                    AUDIO_CODEC_CAPTURE_PREAMP_ATT_HANDFREE, -1), error);
+                                    AUDIO_CODEC_CAPTURE_PREAMP_ATT_HEADSET, -1), error);
         CHECK_ERROR(mAlsaControl->set("Capture Volume",
-                                    AUDIO_CODEC_CAPTURE_VOL_HANDFREE, -1), error);
+                                    AUDIO_CODEC_CAPTURE_VOL_HEADSET, -1), error);
     }
-    CHECK_ERROR(mAlsaControl->set("AUDUL Voice UL Volume",
-                                AUDIO_ABE_AUDUL_VOICE_VOL_HANDFREE, -1), error);
-    CHECK_ERROR(configMicrophones(), error);
-    CHECK_ERROR(configEqualizers(), error);
 
-    return error;
-}
-
-status_t AudioModemAlsa::voiceCallCodecSetHeadset()
-{
-    status_t error = NO_ERROR;
-
-    // Enable Playback voice path
-    CHECK_ERROR(mAlsaControl->set("HS Left Playback", "HS DAC"), error);
-    CHECK_ERROR(mAlsaControl->set("HS Right Playback", "HS DAC"), error);
-    CHECK_ERROR(mAlsaControl->set("Headset Playback Volume", AUDIO_CODEC_HEADSET_GAIN), error);
-    CHECK_ERROR(mAlsaControl->set("DL1 Mono Mixer", 1), error);
-    CHECK_ERROR(mAlsaControl->set("DL1 Mixer Voice", 1), error);
-    CHECK_ERROR(mAlsaControl->set("Sidetone Mixer Playback", 1), error);
-    CHECK_ERROR(mAlsaControl->set("DL1 PDM Switch", 1), error);
-    CHECK_ERROR(mAlsaControl->set("SDT DL Volume",
-                                AUDIO_ABE_SIDETONE_DL_VOL_HEADSET, -1), error);
-
-    // Enable Capture voice path
-    CHECK_ERROR(mAlsaControl->set("Analog Left Capture Route", "Headset Mic"), error);
-    CHECK_ERROR(mAlsaControl->set("Analog Right Capture Route", "Headset Mic"), error);
-    CHECK_ERROR(mAlsaControl->set("Capture Preamplifier Volume",
-                                AUDIO_CODEC_CAPTURE_PREAMP_ATT_HEADSET, -1), error);
-    CHECK_ERROR(mAlsaControl->set("Capture Volume",
-                                AUDIO_CODEC_CAPTURE_VOL_HEADSET, -1), error);
-    CHECK_ERROR(mAlsaControl->set("AUDUL Voice UL Volume",
-                                AUDIO_ABE_AUDUL_VOICE_VOL_HEADSET, -1), error);
-    CHECK_ERROR(configMicrophones(), error);
-    CHECK_ERROR(configEqualizers(), error);
-
-    return error;
-}
-
-#ifdef AUDIO_BLUETOOTH
-status_t AudioModemAlsa::voiceCallCodecSetBluetooth()
-{
-    status_t error = NO_ERROR;
-
-    // Enable Playback voice path
-    CHECK_ERROR(mAlsaControl->set("DL1 Mono Mixer", 1), error);
-    CHECK_ERROR(mAlsaControl->set("DL1 Mixer Voice", 1), error);
-    CHECK_ERROR(mAlsaControl->set("Sidetone Mixer Playback", 1), error);
-    CHECK_ERROR(mAlsaControl->set("SDT DL Volume",
-                                AUDIO_ABE_SIDETONE_DL_VOL_BLUETOOTH, -1), error);
-
-    // Enable Capture voice path
-    CHECK_ERROR(mAlsaControl->set("AUDUL Voice UL Volume",
-                                AUDIO_ABE_AUDUL_VOICE_VOL_BLUETOOTH, -1), error);
-    CHECK_ERROR(mAlsaControl->set("DL1 PDM Switch", 0, 0), error);
-    CHECK_ERROR(mAlsaControl->set("DL1 BT_VX Switch", 1), error);
     CHECK_ERROR(configMicrophones(), error);
     CHECK_ERROR(configEqualizers(), error);
 
     return error;
 }
-#endif
-
-status_t AudioModemAlsa::voiceCallCodecUpdateHandset()
-{
-    status_t error = NO_ERROR;
-
-    switch (mPreviousAudioModemModes) {
-    case AudioModemInterface::AUDIO_MODEM_HANDFREE:
-        // Disable the ABE DL2 mixer used for Voice
-        CHECK_ERROR(mAlsaControl->set("DL2 Mixer Voice", 0, 0), error);
-        CHECK_ERROR(mAlsaControl->set("DL2 Mono Mixer", 0, 0), error);
-        CHECK_ERROR(voiceCallCodecSetHandset(), error);
-        break;
-
-    case AudioModemInterface::AUDIO_MODEM_HEADSET:
-    case AudioModemInterface::AUDIO_MODEM_BLUETOOTH:
-        CHECK_ERROR(voiceCallCodecSetHandset(), error);
-        break;
-
-    case AudioModemInterface::AUDIO_MODEM_HANDSET:
-    default:
-        ALOGE("%s: Wrong mPreviousAudioModemModes: %04x",
-                __FUNCTION__,
-                mPreviousAudioModemModes);
-        error = INVALID_OPERATION;
-        break;
-
-    } //switch (mPreviousAudioModemModes)
-
-    return error;
-}
-
-status_t AudioModemAlsa::voiceCallCodecUpdateHandfree()
-{
-    status_t error = NO_ERROR;
-
-    switch (mPreviousAudioModemModes) {
-    case AudioModemInterface::AUDIO_MODEM_HANDSET:
-    case AudioModemInterface::AUDIO_MODEM_HEADSET:
-    case AudioModemInterface::AUDIO_MODEM_BLUETOOTH:
-        // Disable the ABE DL1 mixer used for Voice
-        CHECK_ERROR(mAlsaControl->set("DL1 Mixer Voice", 0, 0), error);
-        CHECK_ERROR(mAlsaControl->set("DL1 Mono Mixer", 0, 0), error);
-        CHECK_ERROR(voiceCallCodecSetHandfree(), error);
-        break;
-
-    case AudioModemInterface::AUDIO_MODEM_HANDFREE:
-    default:
-        ALOGE("%s: Wrong mPreviousAudioModemModes: %04x",
-                __FUNCTION__,
-                mPreviousAudioModemModes);
-        error = INVALID_OPERATION;
-        break;
-
-    } //switch (mPreviousAudioModemModes)
-
-    return error;
-}
-
-status_t AudioModemAlsa::voiceCallCodecUpdateHeadset()
-{
-    status_t error = NO_ERROR;
-
-    switch (mPreviousAudioModemModes) {
-    case AudioModemInterface::AUDIO_MODEM_HANDFREE:
-        // Disable the ABE DL2 mixer used for Voice
-        CHECK_ERROR(mAlsaControl->set("DL2 Mixer Voice", 0, 0), error);
-        CHECK_ERROR(mAlsaControl->set("DL2 Mono Mixer", 0, 0), error);
-        CHECK_ERROR(voiceCallCodecSetHeadset(), error);
-        break;
-
-    case AudioModemInterface::AUDIO_MODEM_HANDSET:
-    case AudioModemInterface::AUDIO_MODEM_BLUETOOTH:
-        CHECK_ERROR(voiceCallCodecSetHeadset(), error);
-        break;
-
-    case AudioModemInterface::AUDIO_MODEM_HEADSET:
-    default:
-        ALOGE("%s: Wrong mPreviousAudioModemModes: %04x",
-                __FUNCTION__,
-                mPreviousAudioModemModes);
-        error = INVALID_OPERATION;
-        break;
-
-    } //switch (mPreviousAudioModemModes)
-
-    return error;
-}
 
-#ifdef AUDIO_BLUETOOTH
-status_t AudioModemAlsa::voiceCallCodecUpdateBluetooth()
+status_t AudioModemAlsa::voiceCallCodecPathUpdate()
 {
     status_t error = NO_ERROR;
 
-    switch (mPreviousAudioModemModes) {
-    case AudioModemInterface::AUDIO_MODEM_HANDFREE:
-        // Disable the ABE DL2 mixer used for Voice
-        CHECK_ERROR(mAlsaControl->set("DL2 Mixer Voice", 0, 0), error);
-        CHECK_ERROR(mAlsaControl->set("DL2 Mono Mixer", 0, 0), error);
-        CHECK_ERROR(voiceCallCodecSetBluetooth(), error);
-    case AudioModemInterface::AUDIO_MODEM_HANDSET:
-    case AudioModemInterface::AUDIO_MODEM_HEADSET:
-        CHECK_ERROR(voiceCallCodecSetBluetooth(), error);
-        break;
-
-    case AudioModemInterface::AUDIO_MODEM_BLUETOOTH:
-    default:
-        ALOGE("%s: Wrong mPreviousAudioModemModes: %04x",
-                __FUNCTION__,
-                mPreviousAudioModemModes);
-        error = INVALID_OPERATION;
-        break;
-
-    } //switch (mPreviousAudioModemModes)
-
-    return error;
-}
-#endif // AUDIO_BLUETOOTH
-
-status_t AudioModemAlsa::voiceCallCodecUpdate()
-{
-    status_t error = NO_ERROR;
+    const voiceCallCodecProfile *from, *to;
+    int written;
 
     ALOGV("Update Audio Codec Voice call: %04x", mCurrentAudioModemModes);
 
-    if (mCurrentAudioModemModes & AudioModemInterface::AUDIO_MODEM_HANDSET) {
-        error = voiceCallCodecPCMReset();
-        error = voiceCallCodecUpdateHandset();
-    } else if (mCurrentAudioModemModes & AudioModemInterface::AUDIO_MODEM_HANDFREE) {
-        error = voiceCallCodecPCMReset();
-        error = voiceCallCodecUpdateHandfree();
-    } else if (mCurrentAudioModemModes & AudioModemInterface::AUDIO_MODEM_HEADSET) {
-        error = voiceCallCodecPCMReset();
-        error = voiceCallCodecUpdateHeadset();
-#ifdef AUDIO_BLUETOOTH
-    } else if (mCurrentAudioModemModes & AudioModemInterface::AUDIO_MODEM_BLUETOOTH) {
-        error = voiceCallCodecPCMReset();
-        error = voiceCallCodecUpdateBluetooth();
-#endif
-    } else {
+    from = voiceCallCodecProfileFind(mPreviousAudioModemModes);
+    to = voiceCallCodecProfileFind(mCurrentAudioModemModes);
+    if (!to) {
         ALOGE("Audio Modem mode not supported: %04x", mCurrentAudioModemModes);
         return INVALID_OPERATION;
     }
 
-    error = voiceCallCodecPCMSet();
-    error = voiceCallSidetoneSet(mCurrentAudioModemModes);
+    voiceCallCodecPCMReset();
+    CHECK_ERROR(voiceCallCodecProfileSet(from, to, &written), error);
+    alsaTrace(ALSA_TRACE_VOICE_ROUTE, mCurrentAudioModemModes, written);
+    ALOGV("Voice call codec %04x -> %04x: %d controls written",
+            mPreviousAudioModemModes, mCurrentAudioModemModes, written);
+    CHECK_ERROR(voiceCallCodecCaptureSet(), error);
 
     return error;
 }
@@ -1100,30 +1309,36 @@ status_t AudioModemAlsa::voiceCallModemReset()
     return error;
 }
 
-status_t AudioModemAlsa::voiceCallVolume(ALSAControl *alsaControl, float volume)
+status_t AudioModemAlsa::voiceCallVolume(float volume)
 {
     status_t error = NO_ERROR;
-    unsigned int setVolume;
-    int i = 0;
+    int step = 0;
 
-    while(voiceCallVolumeProp[i].device) {
-        voiceCallVolumeInfo *info = voiceCallVolumeProp[i].mInfo;
+    if (mVolumeInitStatus != NO_ERROR)
+        return mVolumeInitStatus;
 
-        // Make sure volume is between bounds.
-        setVolume = info->min + volume * (info->max - info->min);
-        if (setVolume > info->max) setVolume = info->max;
-        if (setVolume < info->min) setVolume = info->min;
+    if (volume > 0)
+        step = (int)(volume * (VOICE_CALL_VOLUME_STEPS - 1) + 0.5f);
+    if (step > VOICE_CALL_VOLUME_STEPS - 1)
+        step = VOICE_CALL_VOLUME_STEPS - 1;
+
+    for (int i = 0; i < voiceCallVolumeCurveCount; i++) {
+        voiceCallVolumeCurve *curve = &voiceCallVolumeCurves[i];
+        unsigned int setVolume = curve->values[step];
 
-        ALOGV("%s: in call volume level to apply: %d", voiceCallVolumeProp[i].volumeName,
-                setVolume);
+        // repeated volume keys often land on the same mixer step
+        if ((int)setVolume == curve->lastValue)
+            continue;
 
-        error = alsaControl->set(voiceCallVolumeProp[i].volumeName, setVolume, 0);
+        ALOGV("%s: in call volume level to apply: %d", curve->volumeName, setVolume);
+
+        error = mVolumeControl->set(curve->volumeName, setVolume, 0);
         if (error < 0) {
-            ALOGE("%s: error applying in call volume: %d", voiceCallVolumeProp[i].volumeName,
-                    setVolume);
+            ALOGE("%s: error applying in call volume: %d", curve->volumeName, setVolume);
+            curve->lastValue = -1;
             return error;
         }
-        i++;
+        curve->lastValue = setVolume;
     }
     return NO_ERROR;
 }
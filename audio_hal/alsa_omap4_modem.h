@@ -20,6 +20,7 @@
 
 #include <utils/Errors.h>
 #include <utils/KeyedVector.h>
+#include <utils/Timers.h>
 
 namespace android
 {
@@ -298,6 +299,16 @@ struct voiceCallVolumeInfo
     unsigned int      max;
 };
 
+// Voice call volume from 0.0 to 1.0 in 1% steps
+#define VOICE_CALL_VOLUME_STEPS   101
+
+struct voiceCallVolumeCurve
+{
+    const char      *volumeName;
+    unsigned int    values[VOICE_CALL_VOLUME_STEPS];
+    int             lastValue;      // last written, -1 if unknown
+};
+
 struct voiceCallVolumeList
 {
     const uint32_t  device;
@@ -305,12 +316,20 @@ struct voiceCallVolumeList
     voiceCallVolumeInfo *mInfo;
 };
 
+// Pending voice call commands. Route updates within the same call state
+// are merged into the last pending command, entering or leaving the call
+// always takes a command of its own.
+#define VOICE_CALL_CONTROL_QUEUE_SIZE   8
+
+// time voiceCallControlsStop() gives the control thread to exit
+#define VOICE_CALL_CONTROL_STOP_TIMEOUT 2   // in seconds
+
 struct voiceCallControlMainInfo
 {
-    bool        updateFlag;
     uint32_t    devices;
     int         mode;
     bool       multimediaUpdate;
+    nsecs_t     queued;     // when first queued, merges keep it
 };
 
 struct voiceCallControlLocalInfo
@@ -366,24 +385,55 @@ public:
 
 
     AudioModemInterface *create(void);
+    // NO_ERROR once the voice call control thread runs
+    status_t     initCheck(void);
     status_t     audioModemSetProperties(void);
     status_t     voiceCallControls(uint32_t devices, int mode, bool multimediaUpdate);
     // Voice Call control thread
     void        voiceCallControlsThread(void);
+    status_t    voiceCallControlsStop(void);
     void        voiceCallControlsMutexLock(void);
     void        voiceCallControlsMutexUnlock(void);
+    void        voiceCallControlsQueueLocked(uint32_t devices, int mode, bool multimediaUpdate);
+    bool        voiceCallControlsDequeueLocked(voiceCallControlMainInfo *command);
 
     status_t     setCurrentAudioModemModes(uint32_t devices);
 
-    status_t     voiceCallCodecSet(void);
-    status_t     voiceCallCodecUpdate(void);
+    typedef status_t (AudioModemAlsa::*voiceCallStep_t)(void);
+    status_t     voiceCallModemCodecSteps(voiceCallStep_t modemStep,
+                                          voiceCallStep_t codecStep,
+                                          nsecs_t *modemTime,
+                                          nsecs_t *codecTime);
+
+    status_t     voiceCallCodecPathSet(void);
+    status_t     voiceCallCodecPathUpdate(void);
+    status_t     voiceCallCodecLinkSet(void);
     status_t     voiceCallCodecReset(void);
-    status_t     voiceCallCodecSetHandset(void);
-    status_t     voiceCallCodecSetHandfree(void);
-    status_t     voiceCallCodecSetHeadset(void);
-    status_t     voiceCallCodecUpdateHandset(void);
-    status_t     voiceCallCodecUpdateHandfree(void);
-    status_t     voiceCallCodecUpdateHeadset(void);
+    // One mixer control of a voice call codec profile
+    struct voiceCallCodecControl
+    {
+        const char      *name;
+        const char      *str;       // enumerated value, NULL if numeric
+        unsigned int    value;
+        int             index;
+    };
+
+    // Codec controls of an audio modem mode, fixed once the module is up
+    struct voiceCallCodecProfile
+    {
+        uint32_t                    modes;
+        const voiceCallCodecControl *controls;
+        const voiceCallCodecControl *release;   // when moving to a profile
+                                                // not setting them
+        uint32_t                    shared;     // bit i: controls[i] is also
+                                                // set by the output routing
+    };
+
+    const voiceCallCodecProfile *voiceCallCodecProfileFind(uint32_t modes);
+    status_t     voiceCallCodecProfileSet(const voiceCallCodecProfile *from,
+                                          const voiceCallCodecProfile *to,
+                                          int *written);
+    status_t     voiceCallCodecCaptureSet(void);
     status_t     voiceCallCodecPCMSet(void);
     status_t     voiceCallCodecPCMReset(void);
     status_t     voiceCallCodecStop(void);
@@ -399,12 +449,12 @@ public:
     status_t     voiceCallSidetoneReset();
 
     #ifdef AUDIO_BLUETOOTH
-        status_t     voiceCallCodecSetBluetooth(void);
-        status_t     voiceCallCodecUpdateBluetooth(void);
         status_t     voiceCallCodecBTPCMSet(void);
         status_t     voiceCallCodecBTPCMReset(void);
     #endif
-    status_t voiceCallVolume(ALSAControl *alsaControl, float volume);
+    status_t voiceCallVolume(float volume);
+    ALSAControl *mVolumeControl;
+    status_t mVolumeInitStatus;     // volume control range query result
 
     char        *mBoardName;
     int         mVoiceCallState;
@@ -415,7 +465,18 @@ public:
     AudioModemDeviceProperties *mDeviceProp;
     AudioModemDeviceProperties *mDevicePropPrevious;
 
-    voiceCallControlMainInfo    mVoiceCallControlMainInfo;
+    // Voice call commands, guarded by mVoiceCallControlMutex
+    voiceCallControlMainInfo    mVoiceCallControlQueue[VOICE_CALL_CONTROL_QUEUE_SIZE];
+    int                         mVoiceCallControlHead;
+    int                         mVoiceCallControlCount;
+    voiceCallControlMainInfo    mVoiceCallControlLast;  // last one queued
+    bool                        mVoiceCallControlStop;  // thread asked to exit
+    bool                        mVoiceCallControlExited;
+    bool                        mVoiceCallControlRunning;   // created, not joined yet
+    status_t                    mInitStatus;
+
+    // Voice call control thread state, only touched by that thread
+    voiceCallControlLocalInfo   *mInfo;
 
     AudioModemInterface     *mModem;
 
@@ -432,8 +493,8 @@ public:
     // Posix thread
     pthread_t       mVoiceCallControlThread;
     pthread_mutex_t mVoiceCallControlMutex;
-    pthread_once_t  mVoiceCallControlKeyOnce;
     pthread_cond_t  mVoiceCallControlNewParams;
+    pthread_cond_t  mVoiceCallControlExit;
 
     // Multimedia update
     status_t     multimediaCodecUpdate(void);
@@ -0,0 +1,351 @@
+/* alsa_omap_core.cpp
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#define LOG_TAG "OmapALSACore"
+#include <utils/Log.h>
+#include <utils/Errors.h>
+#include <alloca.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "alsa_omap_core.h"
+
+namespace android
+{
+
+static const unsigned int probeRates[] = {
+    8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000
+};
+
+static const char *streamName(snd_pcm_t *pcm)
+{
+    return snd_pcm_stream_name(snd_pcm_stream(pcm));
+}
+
+// frames played in 'usec' at the committed rate
+static snd_pcm_uframes_t usecToFrames(snd_pcm_t *pcm, unsigned int usec)
+{
+    snd_pcm_hw_params_t *params;
+    unsigned int rate = 0;
+
+    snd_pcm_hw_params_alloca(&params);
+    if ((snd_pcm_hw_params_current(pcm, params) < 0) ||
+        (snd_pcm_hw_params_get_rate(params, &rate, 0) < 0))
+        return 0;
+
+    return (snd_pcm_uframes_t)((uint64_t)rate * usec / 1000000);
+}
+
+int alsaPcmProbeCaps(const char *name, snd_pcm_stream_t stream,
+                     alsa_pcm_caps_t *caps)
+{
+    snd_pcm_hw_params_t *params;
+    snd_pcm_t *pcm;
+    int err;
+
+    caps->probed = false;
+
+    err = snd_pcm_open(&pcm, name, stream, SND_PCM_NONBLOCK);
+    if (err < 0) {
+        ALOGV("Unable to probe %s %s: %s", name,
+              snd_pcm_stream_name(stream), snd_strerror(err));
+        return err;
+    }
+
+    if (snd_pcm_hw_params_malloc(&params) < 0) {
+        snd_pcm_close(pcm);
+        return -ENOMEM;
+    }
+
+    err = snd_pcm_hw_params_any(pcm, params);
+    if (err == 0) {
+        caps->mmap = snd_pcm_hw_params_test_access(pcm, params,
+                        SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+        caps->rw = snd_pcm_hw_params_test_access(pcm, params,
+                        SND_PCM_ACCESS_RW_INTERLEAVED) == 0;
+        caps->formats = 0;
+        for (int f = 0; (f < 32) && (f <= SND_PCM_FORMAT_LAST); f++) {
+            if (snd_pcm_hw_params_test_format(pcm, params, (snd_pcm_format_t)f) == 0)
+                caps->formats |= 1 << f;
+        }
+        snd_pcm_hw_params_get_channels_min(params, &caps->channelsMin);
+        snd_pcm_hw_params_get_channels_max(params, &caps->channelsMax);
+        caps->rates = 0;
+        for (size_t r = 0; r < sizeof(probeRates) / sizeof(probeRates[0]); r++) {
+            if (snd_pcm_hw_params_test_rate(pcm, params, probeRates[r], 0) == 0)
+                caps->rates |= 1 << r;
+        }
+        caps->probed = true;
+        ALOGI("%s %s: mmap %d rw %d formats %08x channels %u..%u rates %03x",
+              name, snd_pcm_stream_name(stream), caps->mmap, caps->rw,
+              caps->formats, caps->channelsMin, caps->channelsMax, caps->rates);
+    }
+
+    snd_pcm_hw_params_free(params);
+    snd_pcm_close(pcm);
+
+    return err;
+}
+
+bool alsaPcmCapsMatch(const alsa_pcm_caps_t *caps, bool mmap,
+                      snd_pcm_format_t format, unsigned int channels,
+                      unsigned int rate)
+{
+    int r = -1;
+
+    for (size_t i = 0; i < sizeof(probeRates) / sizeof(probeRates[0]); i++) {
+        if (probeRates[i] == rate)
+            r = i;
+    }
+
+    return caps->probed &&
+           (mmap ? caps->mmap : caps->rw) &&
+           (format >= 0) && (format < 32) && (caps->formats & (1 << format)) &&
+           (channels >= caps->channelsMin) && (channels <= caps->channelsMax) &&
+           (r >= 0) && (caps->rates & (1 << r));
+}
+
+int alsaPcmSetFormat(snd_pcm_t *pcm, snd_pcm_hw_params_t *params, bool mmap,
+                     snd_pcm_format_t format, unsigned int channels)
+{
+    int err;
+
+    // snd_pcm_format_description() and snd_pcm_format_name() do not perform
+    // proper bounds checking.
+    bool validFormat = (static_cast<int> (format) > SND_PCM_FORMAT_UNKNOWN) &&
+            (static_cast<int> (format) <= SND_PCM_FORMAT_LAST);
+    const char *formatDesc = validFormat ? snd_pcm_format_description(format)
+            : "Invalid Format";
+    const char *formatName = validFormat ? snd_pcm_format_name(format)
+            : "UNKNOWN";
+
+    // Set the interleaved read and write format.
+    if (mmap) {
+        snd_pcm_access_mask_t *mask =
+            (snd_pcm_access_mask_t *)alloca(snd_pcm_access_mask_sizeof());
+        snd_pcm_access_mask_none(mask);
+        snd_pcm_access_mask_set(mask, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+        err = snd_pcm_hw_params_set_access_mask(pcm, params, mask);
+    } else
+        err = snd_pcm_hw_params_set_access(pcm, params,
+                SND_PCM_ACCESS_RW_INTERLEAVED);
+    if (err < 0) {
+        ALOGE("Unable to configure PCM read/write format: %s",
+                snd_strerror(err));
+        return err;
+    }
+
+    err = snd_pcm_hw_params_set_format(pcm, params, format);
+    if (err < 0) {
+        ALOGE("Unable to configure PCM format %s (%s): %s",
+                formatName, formatDesc, snd_strerror(err));
+        return err;
+    }
+
+    ALOGV("Set %s PCM format to %s (%s)", streamName(pcm), formatName, formatDesc);
+
+    err = snd_pcm_hw_params_set_channels(pcm, params, channels);
+    if (err < 0) {
+        ALOGE("Unable to set channel count to %u: %s",
+                channels, snd_strerror(err));
+        return err;
+    }
+
+    ALOGV("Using %u %s for %s.", channels,
+            channels == 1 ? "channel" : "channels", streamName(pcm));
+
+    return 0;
+}
+
+// The first open of a handle happens in openOutputStream, before the stream
+// config is read back by AudioFlinger. Until then the handle can still move
+// to a rate the hardware runs natively, so that the framework resamples once
+// instead of the plug layer converting again behind it. This is negotiation
+// only: no resampling stage was attempted in the DSP plugin, so whatever
+// conversion is left still runs in AudioFlinger or the plug layer.
+static bool rateNegotiated[ALSA_MAX_PROFILES];
+
+static bool knownProfile(int profile)
+{
+    return (profile >= 0) && (profile < ALSA_MAX_PROFILES);
+}
+
+int alsaPcmSetRate(snd_pcm_t *pcm, snd_pcm_hw_params_t *params, int profile,
+                   unsigned int *rate, unsigned int *actual)
+{
+    int err;
+    // capture keeps its rate: a handle opened at 8 kHz (default, SCO) would
+    // otherwise stick at the native rate for every later open
+    bool negotiate = knownProfile(profile) && !rateNegotiated[profile] &&
+            (snd_pcm_stream(pcm) == SND_PCM_STREAM_PLAYBACK);
+
+    // while the rate can still be negotiated, keep the plug layer from
+    // resampling so set_rate_near() lands on a rate the hardware supports
+    if (negotiate)
+        snd_pcm_hw_params_set_rate_resample(pcm, params, 0);
+
+    *actual = *rate;
+    err = snd_pcm_hw_params_set_rate_near(pcm, params, actual, 0);
+    if (err < 0) {
+        ALOGE("Unable to set %s sample rate to %u: %s",
+                streamName(pcm), *rate, snd_strerror(err));
+        return err;
+    }
+
+    if ((*actual != *rate) && negotiate)
+        ALOGI("Using native %s rate %u HZ instead of %u HZ",
+                streamName(pcm), *actual, *rate);
+    else if (*actual != *rate)
+        // Some devices have a fixed sample rate, and can not be changed.
+        // This may cause resampling problems; i.e. PCM playback will be too
+        // slow or fast.
+        ALOGW("Requested rate (%u HZ) does not match actual rate (%u HZ)",
+                *rate, *actual);
+    else
+        ALOGV("Set %s sample rate to %u HZ", streamName(pcm), *actual);
+
+    if (negotiate)
+        *rate = *actual;
+
+    return 0;
+}
+
+void alsaPcmRateCommit(int profile)
+{
+    if (knownProfile(profile))
+        rateNegotiated[profile] = true;
+}
+
+void alsaPcmRateReset()
+{
+    memset(rateNegotiated, 0, sizeof(rateNegotiated));
+}
+
+int alsaPcmSetSoftwareParams(snd_pcm_t *pcm, const alsa_pcm_policy_t *policy)
+{
+    snd_pcm_sw_params_t * softwareParams;
+    int err;
+
+    snd_pcm_uframes_t bufferSize = 0;
+    snd_pcm_uframes_t periodSize = 0;
+    snd_pcm_uframes_t startThreshold, stopThreshold;
+    snd_pcm_stream_t stream = snd_pcm_stream(pcm);
+
+    if (snd_pcm_sw_params_malloc(&softwareParams) < 0) {
+        LOG_ALWAYS_FATAL("Failed to allocate ALSA software parameters!");
+        return NO_INIT;
+    }
+
+    // Get the current software parameters
+    err = snd_pcm_sw_params_current(pcm, softwareParams);
+    if (err < 0) {
+        ALOGE("Unable to get software parameters: %s", snd_strerror(err));
+        goto done;
+    }
+
+    snd_pcm_get_params(pcm, &bufferSize, &periodSize);
+
+    switch (policy->start) {
+    case ALSA_START_BUFFER:
+        startThreshold = bufferSize - 1;
+        break;
+    case ALSA_START_PERIOD:
+        startThreshold = periodSize;
+        break;
+    case ALSA_START_TIME:
+        startThreshold = usecToFrames(pcm, policy->startTime);
+        if (startThreshold > bufferSize)
+            startThreshold = bufferSize;
+        else if (startThreshold < 1)
+            startThreshold = 1;
+        break;
+    case ALSA_START_FIRST_FRAME:
+    default:
+        startThreshold = 1;
+        break;
+    }
+
+    if (policy->stop == ALSA_STOP_NEVER) {
+        ALOGV("Stop Threshold for %s is -1", streamName(pcm));
+        stopThreshold = -1;
+    } else
+        stopThreshold = bufferSize;
+
+    err = snd_pcm_sw_params_set_start_threshold(pcm, softwareParams,
+            startThreshold);
+    if (err < 0) {
+        ALOGE("Unable to set start threshold to %lu frames: %s",
+                startThreshold, snd_strerror(err));
+        goto done;
+    }
+
+    err = snd_pcm_sw_params_set_stop_threshold(pcm, softwareParams,
+            stopThreshold);
+    if (err < 0) {
+        ALOGE("Unable to set stop threshold to %lu frames: %s",
+                stopThreshold, snd_strerror(err));
+        goto done;
+    }
+
+    // Allow the transfer to start when at least periodSize samples can be
+    // processed.
+    err = snd_pcm_sw_params_set_avail_min(pcm, softwareParams, periodSize);
+    if (err < 0) {
+        ALOGE("Unable to configure available minimum to %lu: %s",
+                periodSize, snd_strerror(err));
+        goto done;
+    }
+
+    if (stream == SND_PCM_STREAM_CAPTURE) {
+        // Timestamp the capture hw pointer updates so snd_pcm_htimestamp()
+        // and the stats can tell when the frames being read were sampled.
+        err = snd_pcm_sw_params_set_tstamp_mode(pcm, softwareParams,
+                SND_PCM_TSTAMP_ENABLE);
+        if (err < 0)
+            ALOGW("Unable to enable capture timestamps: %s", snd_strerror(err));
+    } else {
+        // Have the kernel keep the area behind the queued data filled with
+        // silence: an underrun then plays silence instead of stale periods
+        // and the restart after snd_pcm_recover() begins from a silent
+        // buffer.
+        err = snd_pcm_sw_params_set_silence_threshold(pcm, softwareParams,
+                bufferSize - periodSize);
+        if (err == 0)
+            err = snd_pcm_sw_params_set_silence_size(pcm, softwareParams,
+                    bufferSize - periodSize);
+        if (err < 0)
+            ALOGW("Unable to configure silence fill: %s", snd_strerror(err));
+    }
+
+    // Commit the software parameters back to the device.
+    err = snd_pcm_sw_params(pcm, softwareParams);
+    if (err < 0) {
+        ALOGE("Unable to configure software parameters: %s",
+                snd_strerror(err));
+        goto done;
+    }
+
+    ALOGV("%s starts after %lu frames", streamName(pcm), startThreshold);
+
+    done:
+    snd_pcm_sw_params_free(softwareParams);
+
+    return err;
+}
+
+};        // namespace android
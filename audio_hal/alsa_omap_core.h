@@ -0,0 +1,119 @@
+/* alsa_omap_core.h
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#ifndef ANDROID_ALSA_OMAP_CORE
+#define ANDROID_ALSA_OMAP_CORE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+namespace android
+{
+
+// PCM setup shared by the OMAP ALSA modules.
+//
+// Each module keeps its device table, routing and buffer sizing. The hw/sw
+// parameter steps both platforms go through live here, and what differs
+// between them is passed in as an alsa_pcm_policy_t, so a fix to the PCM
+// setup lands on OMAP3 and OMAP4 at once.
+
+// when a stream starts
+enum {
+    ALSA_START_FIRST_FRAME,         // on the first frame, for capture
+    ALSA_START_PERIOD,              // once a period is queued
+    ALSA_START_BUFFER,              // once the buffer is (almost) full
+    ALSA_START_TIME,                // once startTime worth of frames is queued
+};
+
+// when a stream stops
+enum {
+    ALSA_STOP_XRUN,                 // on underrun/overrun
+    ALSA_STOP_NEVER,                // keeps running, e.g. buffer-less FM Rx
+};
+
+typedef struct {
+    int start;                      // ALSA_START_*
+    int stop;                       // ALSA_STOP_*
+    unsigned int startTime;         // in usec, ALSA_START_TIME only
+} alsa_pcm_policy_t;
+
+// Native capabilities of a hw: PCM. Opening a stream whose config matches
+// them on the hw: device skips the plug layer, whose conversions then cost
+// nothing but still add a copy on every write.
+typedef struct {
+    bool probed;
+    bool mmap;                      // MMAP_INTERLEAVED access
+    bool rw;                        // RW_INTERLEAVED access
+    uint32_t formats;               // bit n set if snd_pcm_format_t n is native
+    unsigned int channelsMin;
+    unsigned int channelsMax;
+    uint32_t rates;                 // bit n set if the n-th probed rate is native
+} alsa_pcm_caps_t;
+
+// Opens 'name' without blocking and fills 'caps'. Returns 0 or a negative
+// error code, e.g. when the card isn't there.
+int alsaPcmProbeCaps(const char *name, snd_pcm_stream_t stream,
+                     alsa_pcm_caps_t *caps);
+
+// true when a probed PCM accepts the config as is
+bool alsaPcmCapsMatch(const alsa_pcm_caps_t *caps, bool mmap,
+                      snd_pcm_format_t format, unsigned int channels,
+                      unsigned int rate);
+
+// Sets the interleaved access (mmap or read/write), the sample format and
+// the channel count.
+int alsaPcmSetFormat(snd_pcm_t *pcm, snd_pcm_hw_params_t *params, bool mmap,
+                     snd_pcm_format_t format, unsigned int channels);
+
+// most profiles a module's device table may hold
+#define ALSA_MAX_PROFILES       32
+
+// Index of the entry of a module's device table opened for 'devices', or -1.
+template <typename T, size_t N>
+int alsaProfileIndex(const T (&profiles)[N], uint32_t devices)
+{
+    for (size_t i = 0; i < N; i++) {
+        if (profiles[i].devices == devices)
+            return i;
+    }
+    return -1;
+}
+
+// Sets the rate nearest to '*rate' and returns it in 'actual'. Until
+// 'profile' has been committed, a playback open keeps the plug layer from
+// resampling, so 'actual' is a rate the hardware runs natively and '*rate'
+// moves to it; otherwise '*rate' is kept and a mismatch is only logged.
+int alsaPcmSetRate(snd_pcm_t *pcm, snd_pcm_hw_params_t *params, int profile,
+                   unsigned int *rate, unsigned int *actual);
+
+// Ends the rate negotiation of 'profile', once snd_pcm_hw_params() took
+// the rate alsaPcmSetRate() picked.
+void alsaPcmRateCommit(int profile);
+
+// Reopens the negotiation of every profile, on module init where the
+// handles start again from their default rate.
+void alsaPcmRateReset();
+
+// Applies the start/stop policy, wakes the reader/writer every period,
+// keeps silence behind the queued playback data and timestamps capture.
+// The hw params must already be set.
+int alsaPcmSetSoftwareParams(snd_pcm_t *pcm, const alsa_pcm_policy_t *policy);
+
+};        // namespace android
+
+#endif    // ANDROID_ALSA_OMAP_CORE
@@ -0,0 +1,191 @@
+/* alsa_omap_drain.cpp
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#define LOG_TAG "OmapALSADrain"
+#include <utils/Log.h>
+#include <utils/Mutex.h>
+#include <utils/Condition.h>
+#include <utils/Timers.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "alsa_omap_drain.h"
+#include "alsa_omap_trace.h"
+
+#define DRAIN_MAX_PCMS      4
+#define DRAIN_POLL_TIME     10      // in msec, while a tail plays
+#define DRAIN_DEVICE_LEN    64
+
+namespace android
+{
+
+typedef struct {
+    const void *owner;
+    snd_pcm_t *pcm;                 // NULL once closed or taken back
+    char device[DRAIN_DEVICE_LEN];  // what the PCM was opened on
+    uint32_t stages;                // and its DSP stages
+    nsecs_t tailEnd;                // when the tail finished or was cut
+} drain_slot_t;
+
+static Mutex mLock;
+static Condition mWork;
+static drain_slot_t slots[DRAIN_MAX_PCMS];
+static bool threadStarted;
+
+// true while the PCM still has queued frames to play
+static bool playing(snd_pcm_t *pcm)
+{
+    snd_pcm_sframes_t delay;
+
+    if (snd_pcm_state(pcm) != SND_PCM_STATE_RUNNING)
+        return false;
+
+    return (snd_pcm_delay(pcm, &delay) == 0) && (delay > 0);
+}
+
+static void closeLocked(drain_slot_t *slot)
+{
+    snd_pcm_drop(slot->pcm);
+    snd_pcm_close(slot->pcm);
+    slot->pcm = NULL;
+    slot->tailEnd = systemTime();
+}
+
+static void *drainLoop(void *)
+{
+    AutoMutex lock(mLock);
+
+    for (;;) {
+        bool busy = false;
+
+        for (size_t i = 0; i < DRAIN_MAX_PCMS; i++) {
+            if (!slots[i].pcm)
+                continue;
+            if (playing(slots[i].pcm))
+                busy = true;
+            else
+                closeLocked(&slots[i]);
+        }
+
+        if (busy)
+            mWork.waitRelative(mLock, milliseconds(DRAIN_POLL_TIME));
+        else
+            mWork.wait(mLock);
+    }
+
+    return NULL;
+}
+
+int alsaDrainClose(const void *owner, snd_pcm_t *pcm, const char *device,
+                   uint32_t stages)
+{
+    snd_pcm_sframes_t delay = 0;
+    drain_slot_t *slot = NULL;
+
+    if (snd_pcm_stream(pcm) == SND_PCM_STREAM_PLAYBACK) {
+        // a stream that never reached its start threshold still has to
+        // play what was written, as snd_pcm_drain() would have done
+        if ((snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED) &&
+            (snd_pcm_delay(pcm, &delay) == 0) && (delay > 0))
+            snd_pcm_start(pcm);
+
+        if (playing(pcm)) {
+            AutoMutex lock(mLock);
+
+            for (size_t i = 0; i < DRAIN_MAX_PCMS; i++) {
+                if (!slots[i].pcm && (!slot || (slots[i].owner == owner)))
+                    slot = &slots[i];
+            }
+
+            if (slot && !threadStarted) {
+                pthread_t thread;
+                pthread_attr_t attr;
+
+                pthread_attr_init(&attr);
+                pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+                threadStarted = pthread_create(&thread, &attr, drainLoop, NULL) == 0;
+                pthread_attr_destroy(&attr);
+                if (!threadStarted)
+                    slot = NULL;
+            }
+
+            if (slot) {
+                snd_pcm_delay(pcm, &delay);
+                alsaTrace(ALSA_TRACE_DRAIN, delay, 0);
+                slot->owner = owner;
+                slot->pcm = pcm;
+                strlcpy(slot->device, device ? device : "", sizeof(slot->device));
+                slot->stages = stages;
+                slot->tailEnd = 0;
+                mWork.signal();
+                return 0;
+            }
+        }
+
+        // no room on the drainer: play the tail out here
+        if (playing(pcm))
+            snd_pcm_drain(pcm);
+    }
+
+    return snd_pcm_close(pcm);
+}
+
+snd_pcm_t *alsaDrainReclaim(const void *owner, snd_pcm_stream_t stream,
+                            bool handoff, const char *device, uint32_t stages)
+{
+    AutoMutex lock(mLock);
+    snd_pcm_t *pcm = NULL;
+
+    for (size_t i = 0; i < DRAIN_MAX_PCMS; i++) {
+        drain_slot_t *slot = &slots[i];
+
+        if (slot->owner != owner)
+            continue;
+
+        // the running PCM only fits if it would be opened the same way now
+        if (slot->pcm && handoff && (slot->stages == stages) &&
+            !strcmp(slot->device, device ? device : "") && playing(slot->pcm)) {
+            pcm = slot->pcm;
+            slot->pcm = NULL;
+            alsaTrace(ALSA_TRACE_HANDOFF, 1, 0);
+        } else if (!slot->pcm && slot->tailEnd) {
+            // the tail ran out before the new stream came: that's the gap
+            alsaTrace(ALSA_TRACE_HANDOFF, 0, ns2us(systemTime() - slot->tailEnd));
+        }
+        slot->tailEnd = 0;
+    }
+
+    if (pcm)
+        return pcm;
+
+    // only the tails in the way of this open are cut: the owner's own and
+    // any still holding the device, the others keep playing out
+    for (size_t i = 0; i < DRAIN_MAX_PCMS; i++) {
+        drain_slot_t *slot = &slots[i];
+
+        if (!slot->pcm || (snd_pcm_stream(slot->pcm) != stream))
+            continue;
+        if ((slot->owner == owner) || (device && !strcmp(slot->device, device))) {
+            closeLocked(slot);
+            slot->tailEnd = 0;
+        }
+    }
+
+    return NULL;
+}
+
+};        // namespace android
@@ -0,0 +1,54 @@
+/* alsa_omap_drain.h
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#ifndef ANDROID_ALSA_OMAP_DRAIN
+#define ANDROID_ALSA_OMAP_DRAIN
+
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+namespace android
+{
+
+// Non-blocking close shared by the OMAP ALSA modules.
+//
+// snd_pcm_drain() blocks until the whole buffer has played out, so every
+// close and standby used to hold the caller for up to a buffer of audio.
+// Playback PCMs are now handed to a drainer thread instead, which lets the
+// tail play and closes them afterwards. A stream reopened by the same
+// owner on the same route while its tail still plays takes the running
+// PCM back, and the new audio follows the old without a gap or a restart.
+
+// Hands 'pcm' to the drainer thread. Capture PCMs and PCMs with nothing
+// left to play are closed right away. 'device' and 'stages' record how the
+// PCM was opened: the device name and the alsaDspOpen() stages, 0 for a
+// plain PCM. Returns 0 or the snd_pcm_close() error of a PCM closed right
+// away.
+int alsaDrainClose(const void *owner, snd_pcm_t *pcm, const char *device,
+                   uint32_t stages);
+
+// With 'handoff', returns the PCM 'owner' handed over if its tail is
+// still playing and it was opened on 'device' with 'stages'. Otherwise the
+// 'stream' tails of 'owner' and those opened on 'device' are cut, which
+// frees the device for the open that follows, and NULL is returned. Tails
+// on other devices keep draining.
+snd_pcm_t *alsaDrainReclaim(const void *owner, snd_pcm_stream_t stream,
+                            bool handoff, const char *device, uint32_t stages);
+
+};        // namespace android
+
+#endif    // ANDROID_ALSA_OMAP_DRAIN
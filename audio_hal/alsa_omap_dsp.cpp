@@ -0,0 +1,494 @@
+/* alsa_omap_dsp.cpp
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#define LOG_TAG "OmapALSADsp"
+#include <utils/Log.h>
+#include <utils/Mutex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <alsa/pcm_external.h>
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+#include "alsa_omap_dsp.h"
+#include "alsa_omap_trace.h"
+
+#define EQ_MAX_GAIN     12          // in dB
+#define EQ_Q            1.0f        // of the peaking bands
+#define EQ_MAX_FREQ     0.45f       // bands above this fraction of the rate are skipped
+
+// speaker protection: 4th order Linkwitz-Riley high-pass at the frequency
+// the ABE "High-pass 0dB" profile used, then a look-ahead peak limiter
+#define SPEAKER_HPF_FREQ        800         // in Hz
+#define SPEAKER_HPF_Q           0.7071f
+#define LIMITER_THRESHOLD       29205.0f    // -1dBFS
+#define LIMITER_LOOKAHEAD       2000        // in usec
+#define LIMITER_RELEASE         100000      // in usec
+#define LIMITER_MAX_LOOKAHEAD   192         // frames, LIMITER_LOOKAHEAD at 96kHz
+
+#define DSP_MAX_BIQUADS         (ALSA_EQ_BANDS + 2)
+#define DSP_CHUNK               256         // frames filtered per pass
+
+namespace android
+{
+
+// low shelf, three peaking bands, high shelf
+static const float eqFreqs[ALSA_EQ_BANDS] = { 100, 400, 1600, 4000, 10000 };
+
+// normalized biquad, a0 = 1
+typedef struct {
+    float b0, b1, b2, a1, a2;
+} biquad_t;
+
+typedef struct {
+    snd_pcm_extplug_t ext;
+    uint32_t stages;                // ALSA_DSP_* run by this instance
+    int generation;                 // eqGeneration the filters were built from
+    unsigned int bands;             // biquads in use, 0 when flat
+    float preamp;                   // headroom for the boosted bands
+    biquad_t coef[DSP_MAX_BIQUADS];
+    float z1[DSP_MAX_BIQUADS][2];   // transposed direct form II state,
+    float z2[DSP_MAX_BIQUADS][2];   // per biquad and channel
+
+    // limiter, the signal is delayed by 'lookahead' frames so the gain is
+    // already down when a peak seen on the input reaches the output
+    float delay[LIMITER_MAX_LOOKAHEAD * 2];
+    unsigned int lookahead;
+    unsigned int delayPos;
+    unsigned int hold;              // frames left before the envelope decays
+    float envelope;                 // peak of the samples still in the delay line
+    float gain;
+    float attack;                   // gain smoothing coefficients
+    float release;
+    float envDecay;
+
+    float buf[DSP_CHUNK * 2];
+} dsp_plugin_t;
+
+static Mutex mLock;
+static int eqGains[ALSA_EQ_BANDS];
+static volatile int eqGeneration = 1;
+
+int alsaEqSet(const char *value)
+{
+    int gains[ALSA_EQ_BANDS];
+    const char *p = value;
+    char *end;
+
+    for (int i = 0; i < ALSA_EQ_BANDS; i++) {
+        gains[i] = strtol(p, &end, 10);
+        if ((end == p) || (gains[i] < -EQ_MAX_GAIN) || (gains[i] > EQ_MAX_GAIN))
+            return -EINVAL;
+        if (i < ALSA_EQ_BANDS - 1) {
+            if (*end != ',')
+                return -EINVAL;
+            end++;
+        }
+        p = end;
+    }
+    if (*p)
+        return -EINVAL;
+
+    AutoMutex lock(mLock);
+    memcpy(eqGains, gains, sizeof(eqGains));
+    eqGeneration++;
+    ALOGI("EQ gains %d,%d,%d,%d,%d dB", gains[0], gains[1], gains[2], gains[3], gains[4]);
+
+    return 0;
+}
+
+bool alsaEqFlat()
+{
+    AutoMutex lock(mLock);
+
+    for (int i = 0; i < ALSA_EQ_BANDS; i++) {
+        if (eqGains[i])
+            return false;
+    }
+    return true;
+}
+
+static void biquadNormalize(biquad_t *c, float b0, float b1, float b2,
+                            float a0, float a1, float a2)
+{
+    c->b0 = b0 / a0;
+    c->b1 = b1 / a0;
+    c->b2 = b2 / a0;
+    c->a1 = a1 / a0;
+    c->a2 = a2 / a0;
+}
+
+// shelving and peaking filters from the RBJ audio EQ cookbook
+static void eqDesign(biquad_t *c, int band, int gain, unsigned int rate)
+{
+    float A = powf(10.0f, gain / 40.0f);
+    float w0 = 2.0f * (float)M_PI * eqFreqs[band] / rate;
+    float cw = cosf(w0);
+    float sw = sinf(w0);
+
+    if ((band == 0) || (band == ALSA_EQ_BANDS - 1)) {
+        // shelf slope 1: 2 * sqrt(A) * alpha = sqrt(2A) * sin(w0)
+        float s = sqrtf(2.0f * A) * sw;
+        float sign = (band == 0) ? 1.0f : -1.0f;
+
+        biquadNormalize(c,
+                        A * ((A + 1) - sign * (A - 1) * cw + s),
+                        sign * 2 * A * ((A - 1) - sign * (A + 1) * cw),
+                        A * ((A + 1) - sign * (A - 1) * cw - s),
+                        (A + 1) + sign * (A - 1) * cw + s,
+                        -sign * 2 * ((A - 1) + sign * (A + 1) * cw),
+                        (A + 1) + sign * (A - 1) * cw - s);
+    } else {
+        float alpha = sw / (2.0f * EQ_Q);
+
+        biquadNormalize(c, 1 + alpha * A, -2 * cw, 1 - alpha * A,
+                        1 + alpha / A, -2 * cw, 1 - alpha / A);
+    }
+}
+
+static void highPassDesign(biquad_t *c, float freq, float q, unsigned int rate)
+{
+    float w0 = 2.0f * (float)M_PI * freq / rate;
+    float cw = cosf(w0);
+    float alpha = sinf(w0) / (2.0f * q);
+
+    biquadNormalize(c, (1 + cw) / 2, -(1 + cw), (1 + cw) / 2,
+                    1 + alpha, -2 * cw, 1 - alpha);
+}
+
+// rebuilds the cascade from the current gains: the EQ bands that aren't
+// flat, then the speaker crossover
+static void dspBuild(dsp_plugin_t *dsp)
+{
+    AutoMutex lock(mLock);
+    unsigned int rate = dsp->ext.rate;
+    int boost = 0;
+
+    dsp->bands = 0;
+    for (int i = 0; (dsp->stages & ALSA_DSP_EQ) && (i < ALSA_EQ_BANDS); i++) {
+        if (!eqGains[i] || (eqFreqs[i] >= EQ_MAX_FREQ * rate))
+            continue;
+        eqDesign(&dsp->coef[dsp->bands++], i, eqGains[i], rate);
+        if (eqGains[i] > boost)
+            boost = eqGains[i];
+    }
+    if (dsp->stages & ALSA_DSP_SPEAKER) {
+        highPassDesign(&dsp->coef[dsp->bands++], SPEAKER_HPF_FREQ, SPEAKER_HPF_Q, rate);
+        highPassDesign(&dsp->coef[dsp->bands++], SPEAKER_HPF_FREQ, SPEAKER_HPF_Q, rate);
+    }
+    dsp->preamp = powf(10.0f, -boost / 20.0f);
+    memset(dsp->z1, 0, sizeof(dsp->z1));
+    memset(dsp->z2, 0, sizeof(dsp->z2));
+    dsp->generation = eqGeneration;
+}
+
+static void limiterReset(dsp_plugin_t *dsp)
+{
+    unsigned int rate = dsp->ext.rate;
+
+    dsp->lookahead = (unsigned int)((uint64_t)rate * LIMITER_LOOKAHEAD / 1000000);
+    if (dsp->lookahead > LIMITER_MAX_LOOKAHEAD)
+        dsp->lookahead = LIMITER_MAX_LOOKAHEAD;
+    if (!dsp->lookahead)
+        dsp->lookahead = 1;
+    // the gain gets 98% of the way down within the look-ahead
+    dsp->attack = 1.0f - expf(-4.0f / dsp->lookahead);
+    dsp->release = 1.0f - expf(-1000000.0f / ((float)LIMITER_RELEASE * rate));
+    dsp->envDecay = expf(-1.0f / dsp->lookahead);
+    memset(dsp->delay, 0, sizeof(dsp->delay));
+    dsp->delayPos = 0;
+    dsp->hold = 0;
+    dsp->envelope = 0;
+    dsp->gain = 1.0f;
+}
+
+// one channel of the interleaved float buffer, in place
+static void cascadeChannel(dsp_plugin_t *dsp, unsigned int ch, float *buf,
+                           unsigned int channels, snd_pcm_uframes_t frames)
+{
+    float z1[DSP_MAX_BIQUADS], z2[DSP_MAX_BIQUADS];
+    unsigned int b;
+
+    for (b = 0; b < dsp->bands; b++) {
+        z1[b] = dsp->z1[b][ch];
+        z2[b] = dsp->z2[b][ch];
+    }
+
+    for (buf += ch; frames--; buf += channels) {
+        float x = *buf;
+        for (b = 0; b < dsp->bands; b++) {
+            const biquad_t *c = &dsp->coef[b];
+            float y = c->b0 * x + z1[b];
+            z1[b] = c->b1 * x - c->a1 * y + z2[b];
+            z2[b] = c->b2 * x - c->a2 * y;
+            x = y;
+        }
+        *buf = x;
+    }
+
+    for (b = 0; b < dsp->bands; b++) {
+        dsp->z1[b][ch] = z1[b];
+        dsp->z2[b][ch] = z2[b];
+    }
+}
+
+#ifdef __ARM_NEON__
+// interleaved stereo, both channels filtered together in the two lanes
+static void cascadeStereoNeon(dsp_plugin_t *dsp, float *buf, snd_pcm_uframes_t frames)
+{
+    float32x2_t z1[DSP_MAX_BIQUADS], z2[DSP_MAX_BIQUADS];
+    unsigned int b;
+
+    for (b = 0; b < dsp->bands; b++) {
+        z1[b] = vld1_f32(dsp->z1[b]);
+        z2[b] = vld1_f32(dsp->z2[b]);
+    }
+
+    for (; frames--; buf += 2) {
+        float32x2_t x = vld1_f32(buf);
+        for (b = 0; b < dsp->bands; b++) {
+            const biquad_t *c = &dsp->coef[b];
+            float32x2_t y = vmla_n_f32(z1[b], x, c->b0);
+            z1[b] = vmls_n_f32(vmla_n_f32(z2[b], x, c->b1), y, c->a1);
+            z2[b] = vmls_n_f32(vmul_n_f32(x, c->b2), y, c->a2);
+            x = y;
+        }
+        vst1_f32(buf, x);
+    }
+
+    for (b = 0; b < dsp->bands; b++) {
+        vst1_f32(dsp->z1[b], z1[b]);
+        vst1_f32(dsp->z2[b], z2[b]);
+    }
+}
+#endif
+
+// stereo linked look-ahead limiter, in place
+static void limiterProcess(dsp_plugin_t *dsp, float *buf, unsigned int channels,
+                           snd_pcm_uframes_t frames)
+{
+    float envelope = dsp->envelope;
+    float gain = dsp->gain;
+    unsigned int pos = dsp->delayPos;
+
+    for (; frames--; buf += channels) {
+        float *delayed = &dsp->delay[pos * channels];
+        float peak = fabsf(buf[0]);
+        float target;
+
+        if ((channels == 2) && (fabsf(buf[1]) > peak))
+            peak = fabsf(buf[1]);
+
+        // hold a peak for as long as it sits in the delay line
+        if (peak >= envelope) {
+            envelope = peak;
+            dsp->hold = dsp->lookahead;
+        } else if (dsp->hold) {
+            dsp->hold--;
+        } else {
+            envelope *= dsp->envDecay;
+        }
+
+        target = (envelope > LIMITER_THRESHOLD) ? LIMITER_THRESHOLD / envelope : 1.0f;
+        gain += (target - gain) * ((target < gain) ? dsp->attack : dsp->release);
+
+#ifdef __ARM_NEON__
+        if (channels == 2) {
+            float32x2_t in = vld1_f32(buf);
+            vst1_f32(buf, vmul_n_f32(vld1_f32(delayed), gain));
+            vst1_f32(delayed, in);
+        } else
+#endif
+        for (unsigned int ch = 0; ch < channels; ch++) {
+            float in = buf[ch];
+            buf[ch] = delayed[ch] * gain;
+            delayed[ch] = in;
+        }
+
+        if (++pos == dsp->lookahead)
+            pos = 0;
+    }
+
+    dsp->envelope = envelope;
+    dsp->gain = gain;
+    dsp->delayPos = pos;
+}
+
+static inline int16_t *areaAddr(const snd_pcm_channel_area_t *area, snd_pcm_uframes_t offset)
+{
+    return (int16_t *)((char *)area->addr + (area->first + area->step * offset) / 8);
+}
+
+static inline int16_t dspClamp(float x)
+{
+    if (x >= 32767.0f)
+        return 32767;
+    if (x <= -32768.0f)
+        return -32768;
+    return (int16_t)lrintf(x);
+}
+
+static snd_pcm_sframes_t dspTransfer(snd_pcm_extplug_t *ext,
+                                     const snd_pcm_channel_area_t *dstAreas,
+                                     snd_pcm_uframes_t dstOffset,
+                                     const snd_pcm_channel_area_t *srcAreas,
+                                     snd_pcm_uframes_t srcOffset,
+                                     snd_pcm_uframes_t size)
+{
+    dsp_plugin_t *dsp = (dsp_plugin_t *)ext->private_data;
+    unsigned int channels = ext->channels;
+    snd_pcm_uframes_t done, frames, i;
+    unsigned int ch;
+
+    if ((dsp->stages & ALSA_DSP_EQ) && (dsp->generation != eqGeneration))
+        dspBuild(dsp);
+
+    if (!dsp->bands && !(dsp->stages & ALSA_DSP_SPEAKER)) {
+        snd_pcm_areas_copy(dstAreas, dstOffset, srcAreas, srcOffset,
+                           channels, size, SND_PCM_FORMAT_S16);
+        return size;
+    }
+
+    for (done = 0; done < size; done += frames) {
+        frames = size - done;
+        if (frames > DSP_CHUNK)
+            frames = DSP_CHUNK;
+
+        for (ch = 0; ch < channels; ch++) {
+            const int16_t *src = areaAddr(&srcAreas[ch], srcOffset + done);
+            unsigned int step = srcAreas[ch].step / 16;
+            for (i = 0; i < frames; i++)
+                dsp->buf[i * channels + ch] = src[i * step] * dsp->preamp;
+        }
+
+#ifdef __ARM_NEON__
+        if (channels == 2)
+            cascadeStereoNeon(dsp, dsp->buf, frames);
+        else
+#endif
+        for (ch = 0; ch < channels; ch++)
+            cascadeChannel(dsp, ch, dsp->buf, channels, frames);
+
+        if (dsp->stages & ALSA_DSP_SPEAKER)
+            limiterProcess(dsp, dsp->buf, channels, frames);
+
+        for (ch = 0; ch < channels; ch++) {
+            int16_t *dst = areaAddr(&dstAreas[ch], dstOffset + done);
+            unsigned int step = dstAreas[ch].step / 16;
+            for (i = 0; i < frames; i++)
+                dst[i * step] = dspClamp(dsp->buf[i * channels + ch]);
+        }
+    }
+
+    alsaTrace(ALSA_TRACE_DSP, size, (uint32_t)(dsp->gain * 32768.0f));
+
+    return size;
+}
+
+// called on prepare, once the rate is known
+static int dspInit(snd_pcm_extplug_t *ext)
+{
+    dsp_plugin_t *dsp = (dsp_plugin_t *)ext->private_data;
+
+    dspBuild(dsp);
+    limiterReset(dsp);
+    return 0;
+}
+
+static int dspClose(snd_pcm_extplug_t *ext)
+{
+    free(ext->private_data);
+    return 0;
+}
+
+static const snd_pcm_extplug_callback_t dspCallback = {
+    transfer    : dspTransfer,
+    close       : dspClose,
+    hw_params   : NULL,
+    hw_free     : NULL,
+    dump        : NULL,
+    init        : dspInit,
+};
+
+int alsaDspOpen(snd_pcm_t **pcm, const char *slave, snd_pcm_stream_t stream,
+                int mode, uint32_t stages)
+{
+    char slaveConfig[128];
+    snd_config_t *top, *slaveConf;
+    snd_input_t *in;
+    dsp_plugin_t *dsp;
+    int err;
+
+    if ((stream != SND_PCM_STREAM_PLAYBACK) || !stages)
+        return -EINVAL;
+
+    // the slave is resolved against the global config, like snd_pcm_open()
+    err = snd_config_update();
+    if (err < 0)
+        return err;
+
+    snprintf(slaveConfig, sizeof(slaveConfig), "slave.pcm \"%s\"\n", slave);
+    err = snd_config_top(&top);
+    if (err < 0)
+        return err;
+    err = snd_input_buffer_open(&in, slaveConfig, -1);
+    if (err == 0) {
+        err = snd_config_load(top, in);
+        snd_input_close(in);
+    }
+    if (err == 0)
+        err = snd_config_search(top, "slave", &slaveConf);
+    if (err < 0) {
+        snd_config_delete(top);
+        return err;
+    }
+
+    dsp = (dsp_plugin_t *)calloc(1, sizeof(*dsp));
+    if (!dsp) {
+        snd_config_delete(top);
+        return -ENOMEM;
+    }
+    dsp->ext.version = SND_PCM_EXTPLUG_VERSION;
+    dsp->ext.name = "OMAP software DSP";
+    dsp->ext.callback = &dspCallback;
+    dsp->ext.private_data = dsp;
+    dsp->stages = stages;
+
+    // named after the slave so snd_pcm_name() still tells the device apart
+    err = snd_pcm_extplug_create(&dsp->ext, slave, snd_config, slaveConf,
+                                 stream, mode);
+    snd_config_delete(top);
+    if (err < 0) {
+        ALOGE("Unable to stack the DSP on %s: %s", slave, snd_strerror(err));
+        free(dsp);
+        return err;
+    }
+
+    snd_pcm_extplug_set_param(&dsp->ext, SND_PCM_EXTPLUG_HW_FORMAT, SND_PCM_FORMAT_S16);
+    snd_pcm_extplug_set_slave_param(&dsp->ext, SND_PCM_EXTPLUG_HW_FORMAT, SND_PCM_FORMAT_S16);
+    snd_pcm_extplug_set_param_minmax(&dsp->ext, SND_PCM_EXTPLUG_HW_CHANNELS, 1, 2);
+
+    ALOGV("DSP stages %x on %s", stages, slave);
+    *pcm = dsp->ext.pcm;
+    return 0;
+}
+
+};        // namespace android
@@ -0,0 +1,60 @@
+/* alsa_omap_dsp.h
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#ifndef ANDROID_ALSA_OMAP_DSP
+#define ANDROID_ALSA_OMAP_DSP
+
+#include <alsa/asoundlib.h>
+
+// s_set() key and system property holding the output EQ band gains,
+// "g0,g1,g2,g3,g4" in dB from -12 to 12. All zero is flat.
+#define ALSA_EQ_KEY      "omap.audio.eq"
+#define ALSA_EQ_BANDS    5
+
+// processing stages of alsaDspOpen()
+#define ALSA_DSP_EQ         0x1     // the ALSA_EQ_KEY bands
+#define ALSA_DSP_SPEAKER    0x2     // speaker high-pass crossover and peak limiter
+
+namespace android
+{
+
+// Software DSP on the output path, shared by the OMAP ALSA modules.
+//
+// The write loop lives in libaudio and only ever sees the snd_pcm_t of the
+// handle, so the processing is done by an alsa-lib external filter plugin
+// (extplug) stacked on top of the hardware PCM: libaudio writes into the
+// plugin and the transfer callback filters each period on its way to the
+// slave. A stream that doesn't need any processing is opened without the
+// plugin and costs nothing.
+
+// Sets the EQ band gains from a ALSA_EQ_KEY value. Streams already running
+// through the plugin pick the new gains up at their next period. Returns 0
+// or -EINVAL if the value doesn't parse.
+int alsaEqSet(const char *gains);
+
+// true when every band gain is 0dB
+bool alsaEqFlat();
+
+// Opens 'slave' behind the DSP plugin running 'stages', S16 mono or stereo
+// playback only. The PCM keeps the slave's name. Closing it releases the
+// plugin.
+int alsaDspOpen(snd_pcm_t **pcm, const char *slave, snd_pcm_stream_t stream,
+                int mode, uint32_t stages);
+
+};        // namespace android
+
+#endif    // ANDROID_ALSA_OMAP_DSP
@@ -0,0 +1,81 @@
+/* alsa_omap_pcm.cpp
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#define LOG_TAG "OmapALSAPcm"
+#include <utils/Log.h>
+
+#include "alsa_omap_pcm.h"
+#include "alsa_omap_trace.h"
+
+namespace android
+{
+
+snd_pcm_sframes_t alsaMmapRender(snd_pcm_t *pcm, snd_pcm_format_t format,
+                                 unsigned int channels, snd_pcm_uframes_t frames,
+                                 alsa_render_t render, void *cookie)
+{
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset, size, done = 0;
+    snd_pcm_sframes_t avail, committed;
+    int err;
+
+    avail = snd_pcm_avail_update(pcm);
+    if (avail < 0)
+        return avail;
+    if (frames > (snd_pcm_uframes_t)avail)
+        frames = avail;
+
+    // the ring buffer may wrap, in which case begin only hands out the
+    // contiguous part and a second pass covers the rest
+    while (done < frames) {
+        size = frames - done;
+        err = snd_pcm_mmap_begin(pcm, &areas, &offset, &size);
+        if (err < 0) {
+            ALOGE_RATELIMIT("mmap begin failed: %s", snd_strerror(err));
+            return done ? (snd_pcm_sframes_t)done : err;
+        }
+
+        render(areas, offset, size, format, channels, cookie);
+
+        committed = snd_pcm_mmap_commit(pcm, offset, size);
+        if (committed < 0) {
+            ALOGE_RATELIMIT("mmap commit failed: %s", snd_strerror(committed));
+            return done ? (snd_pcm_sframes_t)done : committed;
+        }
+        done += committed;
+        if ((snd_pcm_uframes_t)committed != size)
+            break;
+    }
+
+    return done;
+}
+
+static void renderSilence(const snd_pcm_channel_area_t *areas,
+                          snd_pcm_uframes_t offset, snd_pcm_uframes_t frames,
+                          snd_pcm_format_t format, unsigned int channels,
+                          void *cookie)
+{
+    snd_pcm_areas_silence(areas, offset, channels, frames, format);
+}
+
+snd_pcm_sframes_t alsaMmapSilence(snd_pcm_t *pcm, snd_pcm_format_t format,
+                                  unsigned int channels, snd_pcm_uframes_t frames)
+{
+    return alsaMmapRender(pcm, format, channels, frames, renderSilence, NULL);
+}
+
+};        // namespace android
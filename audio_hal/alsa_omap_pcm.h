@@ -0,0 +1,50 @@
+/* alsa_omap_pcm.h
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#ifndef ANDROID_ALSA_OMAP_PCM
+#define ANDROID_ALSA_OMAP_PCM
+
+#include <alsa/asoundlib.h>
+
+namespace android
+{
+
+// PCM helpers shared by the OMAP ALSA modules.
+
+// Fills frames [offset, offset + frames) of the ring buffer areas.
+typedef void (*alsa_render_t)(const snd_pcm_channel_area_t *areas,
+                              snd_pcm_uframes_t offset,
+                              snd_pcm_uframes_t frames,
+                              snd_pcm_format_t format,
+                              unsigned int channels,
+                              void *cookie);
+
+// Renders up to 'frames' frames straight into the DMA ring buffer through
+// snd_pcm_mmap_begin()/snd_pcm_mmap_commit(), without an intermediate
+// buffer. The PCM must use an MMAP access type. Returns the number of
+// frames committed or a negative error code.
+snd_pcm_sframes_t alsaMmapRender(snd_pcm_t *pcm, snd_pcm_format_t format,
+                                 unsigned int channels, snd_pcm_uframes_t frames,
+                                 alsa_render_t render, void *cookie);
+
+// Queues 'frames' frames of silence through alsaMmapRender().
+snd_pcm_sframes_t alsaMmapSilence(snd_pcm_t *pcm, snd_pcm_format_t format,
+                                  unsigned int channels, snd_pcm_uframes_t frames);
+
+};        // namespace android
+
+#endif    // ANDROID_ALSA_OMAP_PCM
@@ -0,0 +1,306 @@
+/* alsa_omap_stats.cpp
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#define LOG_TAG "OmapALSAStats"
+#include <utils/Log.h>
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "alsa_omap_stats.h"
+#include "alsa_omap_trace.h"
+
+#define STATS_MAX_STREAMS       8
+#define STATS_SUMMARY_PERIOD    60      // in seconds
+#define STATS_OP_BUCKETS        24      // log2 buckets, 1us .. 16s
+
+namespace android
+{
+
+typedef struct {
+    const void *owner;
+    char name[64];
+    snd_pcm_t *pcm;                 // NULL while the stream is closed
+    snd_pcm_stream_t stream;
+    unsigned int opens;
+    unsigned int xruns;
+    unsigned int samples;
+    uint64_t fillSum;               // sum of the fill levels, in frames
+    snd_pcm_uframes_t minHeadroom;  // bufferSize - avail max, in frames
+    snd_pcm_sframes_t maxDelay;     // in frames
+    unsigned int rate;
+    bool freeRunning;               // stop threshold at the boundary, never xruns
+    nsecs_t maxInputLatency;        // capture only, age of the oldest unread frame
+    alsa_stats_session_t session;
+} alsa_stream_stats_t;
+
+// duration histogram of one entry point: bucket i counts the calls that
+// took [2^i, 2^(i+1)) microseconds
+typedef struct {
+    unsigned int count;
+    unsigned int buckets[STATS_OP_BUCKETS];
+    nsecs_t max;
+} alsa_op_stats_t;
+
+static const char *opNames[ALSA_OP_COUNT] = {
+    "open",
+    "route",
+    "standby",
+    "close",
+    "voice call",
+    "voice modem",
+    "voice codec",
+    "voice link",
+};
+
+static Mutex mLock;
+static alsa_stream_stats_t mStreams[STATS_MAX_STREAMS];
+static alsa_op_stats_t mOps[ALSA_OP_COUNT];
+static nsecs_t mLastSummary = 0;
+
+static alsa_stream_stats_t *findLocked(const void *owner, bool create)
+{
+    alsa_stream_stats_t *unused = NULL;
+
+    for (int i = 0; i < STATS_MAX_STREAMS; i++) {
+        if (mStreams[i].owner == owner)
+            return &mStreams[i];
+        if (!unused && !mStreams[i].owner)
+            unused = &mStreams[i];
+    }
+    if (!create || !unused)
+        return NULL;
+
+    memset(unused, 0, sizeof(*unused));
+    unused->owner = owner;
+    unused->minHeadroom = (snd_pcm_uframes_t)-1;
+    return unused;
+}
+
+static void sampleLocked(alsa_stream_stats_t *s)
+{
+    snd_pcm_status_t *status;
+    snd_pcm_uframes_t bufferSize, avail, availMax, fill;
+    snd_pcm_sframes_t delay;
+
+    if (!s->pcm || snd_pcm_status_malloc(&status) < 0)
+        return;
+
+    if (snd_pcm_status(s->pcm, status) == 0) {
+        bufferSize = s->session.bufferSize;
+        avail = snd_pcm_status_get_avail(status);
+        // the kernel resets avail max on every status call, so this is the
+        // worst case since the previous snapshot
+        availMax = snd_pcm_status_get_avail_max(status);
+        delay = snd_pcm_status_get_delay(status);
+
+        // a free running stream (hostless FM Rx) keeps a full buffer by
+        // design, only the state tells an xrun there
+        if ((snd_pcm_status_get_state(status) == SND_PCM_STATE_XRUN) ||
+            (!s->freeRunning && (availMax >= bufferSize))) {
+            s->xruns++;
+            s->session.xruns++;
+            alsaTrace(ALSA_TRACE_XRUN, snd_pcm_status_get_state(status), availMax);
+        }
+        if (availMax > s->session.availMax)
+            s->session.availMax = availMax;
+        if ((availMax < bufferSize ? bufferSize - availMax : 0) < s->minHeadroom)
+            s->minHeadroom = availMax < bufferSize ? bufferSize - availMax : 0;
+        if (delay > s->maxDelay)
+            s->maxDelay = delay;
+
+        if (s->stream == SND_PCM_STREAM_PLAYBACK)
+            fill = avail < bufferSize ? bufferSize - avail : 0;
+        else
+            fill = avail;
+        s->fillSum += fill;
+        s->samples++;
+
+        // with SND_PCM_TSTAMP_ENABLE, htstamp is the time of the last hw
+        // pointer update and the oldest unread frame was sampled 'avail'
+        // frames before it
+        if ((s->stream == SND_PCM_STREAM_CAPTURE) && s->rate) {
+            snd_htimestamp_t hw;
+            snd_timestamp_t now;
+            snd_pcm_status_get_htstamp(status, &hw);
+            snd_pcm_status_get_tstamp(status, &now);
+            if (hw.tv_sec || hw.tv_nsec) {
+                nsecs_t age = s2ns(now.tv_sec - hw.tv_sec) +
+                              us2ns(now.tv_usec) - hw.tv_nsec +
+                              (nsecs_t)avail * 1000000000 / s->rate;
+                if (age > s->maxInputLatency)
+                    s->maxInputLatency = age;
+            }
+        }
+    }
+
+    snd_pcm_status_free(status);
+}
+
+static void logLocked(const alsa_stream_stats_t *s)
+{
+    ALOGI("%s: opens %u xruns %u fill avg %lu min headroom %lu/%lu max delay %ld",
+          s->name, s->opens, s->xruns,
+          s->samples ? (unsigned long)(s->fillSum / s->samples) : 0,
+          s->minHeadroom == (snd_pcm_uframes_t)-1 ? 0 : s->minHeadroom,
+          s->session.bufferSize, s->maxDelay);
+    if (s->maxInputLatency)
+        ALOGI("%s: max input latency %lldus", s->name,
+              (long long)ns2us(s->maxInputLatency));
+}
+
+// upper bound, in microseconds, of the bucket holding quantile q (percent)
+static unsigned long opQuantile(const alsa_op_stats_t *op, unsigned int q)
+{
+    unsigned int seen = 0;
+    unsigned int rank = (op->count * q + 99) / 100;
+
+    for (int i = 0; i < STATS_OP_BUCKETS; i++) {
+        seen += op->buckets[i];
+        if (seen >= rank)
+            return 2UL << i;
+    }
+    return 2UL << (STATS_OP_BUCKETS - 1);
+}
+
+static void logOpsLocked()
+{
+    for (int i = 0; i < ALSA_OP_COUNT; i++) {
+        const alsa_op_stats_t *op = &mOps[i];
+        if (!op->count)
+            continue;
+        ALOGI("%s: %u calls p50 <%luus p99 <%luus max %lldus", opNames[i],
+              op->count, opQuantile(op, 50), opQuantile(op, 99),
+              (long long)ns2us(op->max));
+    }
+}
+
+static void summaryLocked(bool force)
+{
+    nsecs_t now = systemTime();
+
+    if (!force && (now - mLastSummary < s2ns(STATS_SUMMARY_PERIOD)))
+        return;
+    mLastSummary = now;
+
+    for (int i = 0; i < STATS_MAX_STREAMS; i++) {
+        if (mStreams[i].owner)
+            logLocked(&mStreams[i]);
+    }
+    logOpsLocked();
+}
+
+void alsaStatsOpen(const void *owner, snd_pcm_t *pcm, uint32_t devices)
+{
+    AutoMutex lock(mLock);
+    alsa_stream_stats_t *s = findLocked(owner, true);
+    snd_pcm_uframes_t periodSize;
+    snd_pcm_hw_params_t *params;
+    snd_pcm_sw_params_t *swParams;
+    snd_pcm_uframes_t stopThreshold, boundary;
+
+    if (!s)
+        return;
+
+    s->pcm = pcm;
+    s->stream = snd_pcm_stream(pcm);
+    snprintf(s->name, sizeof(s->name), "%s %s (%08x)", snd_pcm_name(pcm),
+             snd_pcm_stream_name(s->stream), devices);
+    s->opens++;
+    memset(&s->session, 0, sizeof(s->session));
+    snd_pcm_get_params(pcm, &s->session.bufferSize, &periodSize);
+
+    s->rate = 0;
+    if (snd_pcm_hw_params_malloc(&params) == 0) {
+        if (snd_pcm_hw_params_current(pcm, params) == 0)
+            snd_pcm_hw_params_get_rate(params, &s->rate, NULL);
+        snd_pcm_hw_params_free(params);
+    }
+
+    s->freeRunning = false;
+    if (snd_pcm_sw_params_malloc(&swParams) == 0) {
+        if ((snd_pcm_sw_params_current(pcm, swParams) == 0) &&
+            (snd_pcm_sw_params_get_stop_threshold(swParams, &stopThreshold) == 0) &&
+            (snd_pcm_sw_params_get_boundary(swParams, &boundary) == 0))
+            s->freeRunning = stopThreshold >= boundary;
+        snd_pcm_sw_params_free(swParams);
+    }
+}
+
+void alsaStatsSample(const void *owner)
+{
+    AutoMutex lock(mLock);
+    alsa_stream_stats_t *s = findLocked(owner, false);
+
+    if (s)
+        sampleLocked(s);
+    summaryLocked(false);
+}
+
+void alsaStatsClose(const void *owner, alsa_stats_session_t *session)
+{
+    AutoMutex lock(mLock);
+    alsa_stream_stats_t *s = findLocked(owner, false);
+
+    if (!s || !s->pcm) {
+        if (session)
+            memset(session, 0, sizeof(*session));
+        return;
+    }
+
+    sampleLocked(s);
+    if (s->session.xruns)
+        ALOGW("%s: %u xrun(s) this session, avail max %lu/%lu", s->name,
+              s->session.xruns, s->session.availMax, s->session.bufferSize);
+    if (session)
+        *session = s->session;
+    s->pcm = NULL;
+    summaryLocked(false);
+}
+
+void alsaStatsOpTime(int op, nsecs_t duration)
+{
+    AutoMutex lock(mLock);
+    alsa_op_stats_t *stats;
+    nsecs_t us = ns2us(duration);
+    int bucket = 0;
+
+    if ((op < 0) || (op >= ALSA_OP_COUNT))
+        return;
+
+    stats = &mOps[op];
+    while ((us >>= 1) && (bucket < STATS_OP_BUCKETS - 1))
+        bucket++;
+    stats->buckets[bucket]++;
+    stats->count++;
+    if (duration > stats->max)
+        stats->max = duration;
+}
+
+void alsaStatsDump()
+{
+    AutoMutex lock(mLock);
+
+    for (int i = 0; i < STATS_MAX_STREAMS; i++) {
+        if (mStreams[i].owner)
+            sampleLocked(&mStreams[i]);
+    }
+    summaryLocked(true);
+}
+
+};        // namespace android
@@ -0,0 +1,78 @@
+/* alsa_omap_stats.h
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#ifndef ANDROID_ALSA_OMAP_STATS
+#define ANDROID_ALSA_OMAP_STATS
+
+#include <alsa/asoundlib.h>
+#include <utils/Timers.h>
+
+// s_set() key that dumps the counters of every stream to the log
+#define ALSA_STATS_KEY "omap.audio.stats"
+
+namespace android
+{
+
+// PCM telemetry shared by the OMAP ALSA modules.
+//
+// The write/read loop lives in libaudio, so the counters are built from
+// snd_pcm_status() snapshots taken at the module entry points. A stream is
+// identified by its owner (the alsa_handle_t) and keeps its counters across
+// open/close cycles.
+
+// what happened between alsaStatsOpen() and alsaStatsClose()
+typedef struct {
+    unsigned int xruns;             // snapshots that caught an xrun
+    snd_pcm_uframes_t bufferSize;
+    snd_pcm_uframes_t availMax;     // highest avail seen, in frames
+} alsa_stats_session_t;
+
+void alsaStatsOpen(const void *owner, snd_pcm_t *pcm, uint32_t devices);
+void alsaStatsSample(const void *owner);
+void alsaStatsClose(const void *owner, alsa_stats_session_t *session);
+void alsaStatsDump();
+
+// module entry points whose duration is tracked
+enum {
+    ALSA_OP_OPEN,
+    ALSA_OP_ROUTE,
+    ALSA_OP_STANDBY,
+    ALSA_OP_CLOSE,
+    ALSA_OP_VOICE_CALL,             // modem voice call command, queued to done
+    ALSA_OP_VOICE_MODEM,            // modem side of a voice call command
+    ALSA_OP_VOICE_CODEC,            // codec side of a voice call command
+    ALSA_OP_VOICE_LINK,             // modem PCM link start after both
+    ALSA_OP_COUNT
+};
+
+void alsaStatsOpTime(int op, nsecs_t duration);
+
+// times the enclosing scope as one 'op'
+class AlsaOpTimer
+{
+    public:
+        AlsaOpTimer(int op) : mOp(op), mStart(systemTime()) {}
+        ~AlsaOpTimer() { alsaStatsOpTime(mOp, systemTime() - mStart); }
+
+    private:
+        int mOp;
+        nsecs_t mStart;
+};
+
+};        // namespace android
+
+#endif    // ANDROID_ALSA_OMAP_STATS
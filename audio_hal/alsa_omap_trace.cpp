@@ -0,0 +1,89 @@
+/* alsa_omap_trace.cpp
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#define LOG_TAG "OmapALSATrace"
+#include <utils/Log.h>
+#include <cutils/atomic.h>
+
+#include "alsa_omap_trace.h"
+
+#define TRACE_ENTRIES   256     // power of 2
+
+namespace android
+{
+
+typedef struct {
+    nsecs_t time;
+    int event;
+    uint32_t a;
+    uint32_t b;
+} alsa_trace_entry_t;
+
+// A writer claims a slot by bumping the index and fills it without a lock.
+// A dump racing a writer may show that one slot half written, which is
+// fine for a debug aid.
+static alsa_trace_entry_t traceRing[TRACE_ENTRIES];
+static volatile int32_t traceNext;
+
+static const char *eventNames[ALSA_TRACE_COUNT] = {
+    "open", "close", "standby", "route", "xrun", "dsp", "drain", "handoff", "voice",
+};
+
+void alsaTrace(int event, uint32_t a, uint32_t b)
+{
+    alsa_trace_entry_t *e =
+        &traceRing[android_atomic_inc(&traceNext) & (TRACE_ENTRIES - 1)];
+
+    e->time = systemTime();
+    e->event = event;
+    e->a = a;
+    e->b = b;
+}
+
+void alsaTraceDump()
+{
+    int32_t next = android_atomic_acquire_load(&traceNext);
+    int32_t first = (next > TRACE_ENTRIES) ? next - TRACE_ENTRIES : 0;
+    nsecs_t origin = traceRing[first & (TRACE_ENTRIES - 1)].time;
+
+    ALOGI("trace: %d events, last %d", next, next - first);
+    for (int32_t i = first; i < next; i++) {
+        const alsa_trace_entry_t *e = &traceRing[i & (TRACE_ENTRIES - 1)];
+        if ((e->event < 0) || (e->event >= ALSA_TRACE_COUNT))
+            continue;
+        ALOGI("%+10lldus %-8s %08x %u", ns2us(e->time - origin),
+              eventNames[e->event], e->a, e->b);
+    }
+}
+
+bool alsaTraceRateLimit(nsecs_t *last, unsigned int *suppressed,
+                        unsigned int *dropped)
+{
+    nsecs_t now = systemTime();
+
+    if (*last && (now - *last < ALSA_TRACE_LOG_INTERVAL)) {
+        (*suppressed)++;
+        return false;
+    }
+
+    *last = now;
+    *dropped = *suppressed;
+    *suppressed = 0;
+    return true;
+}
+
+};        // namespace android
@@ -0,0 +1,82 @@
+/* alsa_omap_trace.h
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#ifndef ANDROID_ALSA_OMAP_TRACE
+#define ANDROID_ALSA_OMAP_TRACE
+
+#include <stdint.h>
+#include <utils/Timers.h>
+
+// s_set() key that dumps the trace ring to the log
+#define ALSA_TRACE_KEY "omap.audio.trace"
+
+// a rate limited message logs at most once per interval and call site
+#define ALSA_TRACE_LOG_INTERVAL  seconds(5)
+
+namespace android
+{
+
+// Tracing shared by the OMAP ALSA modules, in three tiers:
+//
+// - ALOGV() for anything verbose. It is compiled out unless the file
+//   defines LOG_NDEBUG 0, so no module may ship with that defined.
+// - ALOGW_RATELIMIT()/ALOGE_RATELIMIT() for problems that can repeat on
+//   every period. Repeats within ALSA_TRACE_LOG_INTERVAL are counted and
+//   reported with the next message that gets through.
+// - alsaTrace() for events on the audio path. They go into a fixed ring
+//   in memory, lock-free and without a logd round-trip, and are only
+//   formatted when ALSA_TRACE_KEY dumps the ring.
+
+enum {
+    ALSA_TRACE_OPEN,                // devices, rate
+    ALSA_TRACE_CLOSE,               // devices, 0
+    ALSA_TRACE_STANDBY,             // devices, 0
+    ALSA_TRACE_ROUTE,               // devices, mode
+    ALSA_TRACE_XRUN,                // PCM state, avail
+    ALSA_TRACE_DSP,                 // frames, limiter gain in Q15
+    ALSA_TRACE_DRAIN,               // frames left to play, 0
+    ALSA_TRACE_HANDOFF,             // 1 if the tail was taken over, else
+                                    // 0 and the gap since it ended in usec
+    ALSA_TRACE_VOICE_ROUTE,         // modem modes, codec controls written
+    ALSA_TRACE_COUNT
+};
+
+void alsaTrace(int event, uint32_t a, uint32_t b);
+void alsaTraceDump();
+
+// true if the call site owning 'last' and 'suppressed' may log now, in
+// which case 'dropped' is how many messages it swallowed since
+bool alsaTraceRateLimit(nsecs_t *last, unsigned int *suppressed,
+                        unsigned int *dropped);
+
+};        // namespace android
+
+#define ALSA_LOG_RATELIMIT(log, ...) do {                                   \
+        static nsecs_t _last;                                               \
+        static unsigned int _suppressed;                                    \
+        unsigned int _dropped;                                              \
+        if (android::alsaTraceRateLimit(&_last, &_suppressed, &_dropped)) {  \
+            log(__VA_ARGS__);                                               \
+            if (_dropped)                                                   \
+                log("(%u more like the above)", _dropped);                  \
+        }                                                                   \
+    } while (0)
+
+#define ALOGW_RATELIMIT(...) ALSA_LOG_RATELIMIT(ALOGW, __VA_ARGS__)
+#define ALOGE_RATELIMIT(...) ALSA_LOG_RATELIMIT(ALOGE, __VA_ARGS__)
+
+#endif    // ANDROID_ALSA_OMAP_TRACE
@@ -0,0 +1,147 @@
+/* audio_modem_null.cpp
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#define LOG_TAG "AudioModemNull"
+#include <utils/Log.h>
+
+#include "audio_modem_null.h"
+
+namespace android
+{
+
+AudioModemNull::AudioModemNull() :
+    mRoutes(AUDIO_MODEM_NONE),
+    mSampleRate(PCM_8_KHZ),
+    mMultiMic(MODEM_SINGLE_MIC),
+    mVoiceCallStream(false),
+    mAudioOutputStream(false),
+    mAudioInputStream(false)
+{
+    ALOGW("No audio modem, voice calls only configure the codec");
+}
+
+AudioModemNull::~AudioModemNull()
+{
+}
+
+status_t AudioModemNull::initCheck()
+{
+    return NO_ERROR;
+}
+
+status_t AudioModemNull::setModemRouting(uint32_t routes, uint32_t sampleRate)
+{
+    ALOGV("%s: routes %04x sample rate %d", __FUNCTION__, routes, sampleRate);
+
+    if (routes & ~AUDIO_MODEM_ALL) {
+        ALOGE("%s: unknown routes %04x", __FUNCTION__, routes);
+        return BAD_VALUE;
+    }
+    if (sampleRate >= INVALID_SAMPLE_RATE) {
+        ALOGE("%s: invalid sample rate %d", __FUNCTION__, sampleRate);
+        return BAD_VALUE;
+    }
+
+    mRoutes = routes;
+    mSampleRate = sampleRate;
+    return NO_ERROR;
+}
+
+status_t AudioModemNull::setModemAudioOutputVolume(float nearEndvolume,
+                                                   float farEndvolume)
+{
+    ALOGV("%s: near %f far %f", __FUNCTION__, nearEndvolume, farEndvolume);
+    return NO_ERROR;
+}
+
+status_t AudioModemNull::setModemAudioInputVolume(float nearEndvolume,
+                                                  float farEndvolume)
+{
+    ALOGV("%s: near %f far %f", __FUNCTION__, nearEndvolume, farEndvolume);
+    return NO_ERROR;
+}
+
+status_t AudioModemNull::setModemVoiceCallMultiMic(int multiMic)
+{
+    ALOGV("%s: %d", __FUNCTION__, multiMic);
+
+    if ((multiMic < MODEM_SINGLE_MIC) || (multiMic >= INVALID_MODEM_MIC_SETTING))
+        return BAD_VALUE;
+
+    mMultiMic = multiMic;
+    return NO_ERROR;
+}
+
+// a stream opened twice or closed while not open is a bug in the caller's
+// call sequence, which is the one thing this modem can still report
+status_t AudioModemNull::streamSet(bool *stream, bool open, const char *name)
+{
+    ALOGV("%s %s stream", open ? "Open" : "Close", name);
+
+    if (*stream == open) {
+        ALOGE("%s stream already %s", name, open ? "open" : "closed");
+        return INVALID_OPERATION;
+    }
+
+    *stream = open;
+    return NO_ERROR;
+}
+
+status_t AudioModemNull::OpenModemVoiceCallStream()
+{
+    return streamSet(&mVoiceCallStream, true, "voice call");
+}
+
+status_t AudioModemNull::OpenModemAudioOutputStream(uint32_t sampleRate,
+                                                    int channelUsed,
+                                                    int audioSampleType)
+{
+    ALOGV("%s: sample rate %d channel %d type %d", __FUNCTION__, sampleRate,
+          channelUsed, audioSampleType);
+    return streamSet(&mAudioOutputStream, true, "audio output");
+}
+
+status_t AudioModemNull::OpenModemAudioInputStream(uint32_t sampleRate,
+                                                   int channelUsed,
+                                                   int recordSampleType)
+{
+    ALOGV("%s: sample rate %d channel %d type %d", __FUNCTION__, sampleRate,
+          channelUsed, recordSampleType);
+    return streamSet(&mAudioInputStream, true, "audio input");
+}
+
+status_t AudioModemNull::CloseModemVoiceCallStream()
+{
+    return streamSet(&mVoiceCallStream, false, "voice call");
+}
+
+status_t AudioModemNull::CloseModemAudioOutputStream()
+{
+    return streamSet(&mAudioOutputStream, false, "audio output");
+}
+
+status_t AudioModemNull::CloseModemAudioInputStream()
+{
+    return streamSet(&mAudioInputStream, false, "audio input");
+}
+
+uint32_t AudioModemNull::GetVoiceCallSampleRate()
+{
+    return mSampleRate;
+}
+
+};        // namespace android
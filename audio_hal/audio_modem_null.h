@@ -0,0 +1,73 @@
+/* audio_modem_null.h
+ **
+ ** Copyright 2009-2012 Texas Instruments
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_MODEM_NULL_H
+#define ANDROID_AUDIO_MODEM_NULL_H
+
+#include "audio_modem_interface.h"
+
+// modem.audio.libpath value selecting the built-in modem
+#define AUDIO_MODEM_NULL_PATH   "null"
+
+namespace android
+{
+
+// Audio modem without a modem behind it.
+//
+// It accepts every request, keeps track of the routes and streams it was
+// asked for and reports misuse of the call sequence. The codec side of a
+// voice call still gets configured, so boards without a modem library and
+// bring-up work keep audio going instead of losing the whole HAL.
+class AudioModemNull : public AudioModemInterface
+{
+    public:
+                        AudioModemNull();
+    virtual             ~AudioModemNull();
+
+    virtual status_t    initCheck();
+    virtual status_t    setModemRouting(uint32_t routes=0,
+                                        uint32_t sampleRate=0);
+    virtual status_t    setModemAudioOutputVolume(float nearEndvolume=0,
+                            float farEndvolume=0);
+    virtual status_t    setModemAudioInputVolume(float nearEndvolume=0,
+                            float farEndvolume=0);
+    virtual status_t    setModemVoiceCallMultiMic(int multiMic=0);
+    virtual status_t    OpenModemVoiceCallStream();
+    virtual status_t    OpenModemAudioOutputStream(uint32_t sampleRate=0,
+                            int channelUsed=0,
+                            int audioSampleType=0);
+    virtual status_t    OpenModemAudioInputStream(uint32_t sampleRate=0,
+                            int channelUsed=0,
+                            int recordSampleType=0);
+    virtual status_t    CloseModemVoiceCallStream();
+    virtual status_t    CloseModemAudioOutputStream();
+    virtual status_t    CloseModemAudioInputStream();
+    virtual uint32_t    GetVoiceCallSampleRate();
+
+    private:
+    status_t            streamSet(bool *stream, bool open, const char *name);
+
+    uint32_t            mRoutes;
+    uint32_t            mSampleRate;
+    int                 mMultiMic;
+    bool                mVoiceCallStream;
+    bool                mAudioOutputStream;
+    bool                mAudioInputStream;
+};
+
+};        // namespace android
+#endif    // ANDROID_AUDIO_MODEM_NULL_H